@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const int LINE_WIDTH = 80;
+const int MAX_INDEL_LENGTH = 20;
+const int64_t MIN_REPEAT_LENGTH = 300;   // interspersed repeat copies
+const int64_t MAX_REPEAT_LENGTH = 6000;
+const double REPEAT_FRACTION = 0.3;      // of a synthetic reference
+const double REPEAT_DIVERGENCE = 0.1;    // substitutions per repeat base
+const int64_t MIN_REARRANGEMENT = 1000;  // inversion/translocation length
+const int64_t MAX_REARRANGEMENT = 100000;
+const int64_t MEAN_N_GAP = 5000;
+const int64_t MEAN_SOFT_MASK = 2000;
+const char BASES[4] = {'A', 'C', 'G', 'T'};
+const char IUPAC_CODES[11] = {'R', 'Y', 'K', 'M', 'S', 'W',
+                              'B', 'D', 'H', 'V', 'N'};
+
+// Rates are per base, fractions of the target, counts absolute
+struct MutationOptions {
+  double snp_rate = 0;
+  double indel_rate = 0;
+  int inversions = 0;
+  int translocations = 0;
+  double n_gap_fraction = 0;
+  double soft_mask_fraction = 0;
+  double iupac_rate = 0;
+};
+
+uint64_t rng_state;
+
+void show_help_message(string reason) {
+  /**
+   * Display an error message along with usage instructions
+   */
+  cout << "Error: " << reason << endl;
+  cout << "Usage: ./generate_genome reference -o <output_file> "
+          "-s <size_mb> [--seed <n>]\n"
+          "       ./generate_genome mutate -r <reference_file> -o "
+          "<output_file> [--seed <n>] [--snp <rate>] [--indel <rate>] "
+          "[--inversions <count>] [--translocations <count>] "
+          "[--n-gaps <fraction>] [--soft-mask <fraction>] "
+          "[--iupac <rate>]"
+       << endl;
+}
+
+uint64_t next_random() {
+  /**
+   * splitmix64, the same seed gives the same genome on every platform
+   */
+  uint64_t z = (rng_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+double random_unit() {
+  /**
+   * Uniform double in (0, 1]
+   */
+  return ((next_random() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+int64_t random_range(int64_t low, int64_t high) {
+  /**
+   * Uniform integer in [low, high]
+   */
+  return low + (int64_t)(next_random() % (uint64_t)(high - low + 1));
+}
+
+int64_t next_event(double rate) {
+  /**
+   * Bases until the next event of a per base rate, geometrically
+   * distributed so sparse events cost nothing per base
+   */
+  if (rate <= 0) {
+    return INT64_MAX;
+  }
+  if (rate >= 1) {
+    return 0;
+  }
+  double skip = floor(log(random_unit()) / log1p(-rate));
+  return skip >= (double)INT64_MAX ? INT64_MAX : (int64_t)skip;
+}
+
+char substitute(char base) {
+  /**
+   * A base different from the given one
+   */
+  char other;
+  do {
+    other = BASES[next_random() & 3];
+  } while (other == base);
+  return other;
+}
+
+char complement(char base) {
+  /**
+   * Complementary base, other characters are kept
+   */
+  switch (base) {
+    case 'A':
+      return 'T';
+    case 'C':
+      return 'G';
+    case 'G':
+      return 'C';
+    case 'T':
+      return 'A';
+  }
+  return base;
+}
+
+void reverse_complement(string& sequence, int64_t start, int64_t length) {
+  /**
+   * Invert a segment in place
+   */
+  reverse(sequence.begin() + start, sequence.begin() + start + length);
+  for (int64_t i = start; i < start + length; ++i) {
+    sequence[i] = complement(sequence[i]);
+  }
+}
+
+string generate_reference(int64_t size) {
+  /**
+   * Random bases with interspersed repeats, copies of earlier stretches on
+   * either strand with REPEAT_DIVERGENCE substitutions, so the matcher sees
+   * the multi-copy k-mers of real genomes
+   */
+  string sequence;
+  sequence.reserve(size);
+  while ((int64_t)sequence.size() < size) {
+    int64_t length = random_range(MIN_REPEAT_LENGTH, MAX_REPEAT_LENGTH);
+    length = min(length, size - (int64_t)sequence.size());
+
+    if ((int64_t)sequence.size() > MAX_REPEAT_LENGTH &&
+        random_unit() < REPEAT_FRACTION) {
+      int64_t source = random_range(0, sequence.size() - length);
+      int64_t start = sequence.size();
+      sequence.append(sequence, source, length);
+      if (next_random() & 1) {
+        reverse_complement(sequence, start, length);
+      }
+      for (int64_t i = start + next_event(REPEAT_DIVERGENCE);
+           i < start + length; i += 1 + next_event(REPEAT_DIVERGENCE)) {
+        sequence[i] = substitute(sequence[i]);
+      }
+    } else {
+      for (int64_t i = 0; i < length; ++i) {
+        sequence.push_back(BASES[next_random() & 3]);
+      }
+    }
+  }
+  return sequence;
+}
+
+string load_bases(const string& filename, string& header) {
+  /**
+   * Uppercase bases of a FASTA file, other characters are dropped
+   */
+  ifstream file(filename);
+  if (!file) {
+    throw runtime_error("Cannot open file: " + filename);
+  }
+
+  string sequence, line;
+  while (getline(file, line)) {
+    if (!line.empty() && line[0] == '>') {
+      if (header.empty()) {
+        header = line.substr(1);
+      }
+      continue;
+    }
+    for (char c : line) {
+      c = toupper(c);
+      if (c == 'A' || c == 'C' || c == 'G' || c == 'T') {
+        sequence.push_back(c);
+      }
+    }
+  }
+  return sequence;
+}
+
+void rearrange(string& sequence, const MutationOptions& options) {
+  /**
+   * Inversions reverse complement a segment in place, translocations cut a
+   * segment out and insert it elsewhere
+   */
+  int64_t max_length = min<int64_t>(MAX_REARRANGEMENT, sequence.size() / 10);
+  if (max_length < MIN_REARRANGEMENT) {
+    return;
+  }
+
+  for (int i = 0; i < options.inversions; ++i) {
+    int64_t length = random_range(MIN_REARRANGEMENT, max_length);
+    reverse_complement(sequence, random_range(0, sequence.size() - length),
+                       length);
+  }
+
+  for (int i = 0; i < options.translocations; ++i) {
+    int64_t length = random_range(MIN_REARRANGEMENT, max_length);
+    int64_t source = random_range(0, sequence.size() - length);
+    string segment = sequence.substr(source, length);
+    sequence.erase(source, length);
+    sequence.insert(random_range(0, sequence.size()), segment);
+  }
+}
+
+string mutate_bases(const string& sequence, const MutationOptions& options) {
+  /**
+   * Apply SNPs and short indels in one pass, indel lengths are uniform in
+   * [1, MAX_INDEL_LENGTH] and insertions and deletions equally likely
+   */
+  string target;
+  target.reserve(sequence.size() + sequence.size() / 100);
+
+  int64_t size = sequence.size();
+  int64_t next_snp = next_event(options.snp_rate);
+  int64_t next_indel = next_event(options.indel_rate);
+  int64_t position = 0;
+  while (position < size) {
+    int64_t next = min(next_snp, next_indel);
+    if (next >= size - position) {
+      target.append(sequence, position, size - position);
+      break;
+    }
+    target.append(sequence, position, next);
+    position += next;
+    next_snp -= next;
+    next_indel -= next;
+
+    if (next_indel == 0) {
+      int length = random_range(1, MAX_INDEL_LENGTH);
+      if (next_random() & 1) {
+        for (int i = 0; i < length; ++i) {
+          target.push_back(BASES[next_random() & 3]);
+        }
+      } else {
+        position += length;
+        next_snp = max<int64_t>(0, next_snp - length);
+      }
+      next_indel = next_event(options.indel_rate);
+    } else {
+      target.push_back(substitute(sequence[position]));
+      position++;
+      next_snp = next_event(options.snp_rate);
+      next_indel--;
+    }
+  }
+  return target;
+}
+
+void add_masks(string& target, const MutationOptions& options) {
+  /**
+   * N gaps and soft-masked runs cover about their fraction of the target
+   * with exponentially distributed lengths, IUPAC codes are sprinkled at
+   * their per base rate
+   */
+  int64_t size = target.size();
+  auto cover = [&](double fraction, int64_t mean_length, bool soft_mask) {
+    if (fraction <= 0) {
+      return;
+    }
+    // Runs start at rate fraction / mean_length outside of other runs
+    double start_rate = fraction / mean_length / max(1e-9, 1 - fraction);
+    for (int64_t i = next_event(start_rate); i < size;
+         i += next_event(start_rate)) {
+      int64_t length = 1 + (int64_t)(-log(random_unit()) * mean_length);
+      int64_t end = min(size, i + length);
+      for (; i < end; ++i) {
+        target[i] = soft_mask ? tolower(target[i]) : 'N';
+      }
+    }
+  };
+  cover(options.n_gap_fraction, MEAN_N_GAP, false);
+  cover(options.soft_mask_fraction, MEAN_SOFT_MASK, true);
+
+  for (int64_t i = next_event(options.iupac_rate); i < size;
+       i += 1 + next_event(options.iupac_rate)) {
+    char code = IUPAC_CODES[next_random() % sizeof(IUPAC_CODES)];
+    target[i] = islower(target[i]) ? tolower(code) : code;
+  }
+}
+
+void write_fasta(const string& filename, const string& header,
+                 const string& sequence) {
+  /**
+   * Write the sequence in LINE_WIDTH columns
+   */
+  ofstream out(filename);
+  if (!out) {
+    throw runtime_error("Cannot open output file: " + filename);
+  }
+  out << '>' << header << '\n';
+  for (size_t i = 0; i < sequence.size(); i += LINE_WIDTH) {
+    out.write(&sequence[i], min<size_t>(LINE_WIDTH, sequence.size() - i));
+    out << '\n';
+  }
+  if (!out) {
+    throw runtime_error("Failed writing output file: " + filename);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  /**
+   * Deterministic genomes for the benchmarks, a synthetic reference of a
+   * given size or a target derived from a reference by mutation
+   */
+  if (argc < 2 || (strcmp(argv[1], "reference") != 0 &&
+                   strcmp(argv[1], "mutate") != 0)) {
+    show_help_message("Missing mode.");
+    return 1;
+  }
+  bool mutate = strcmp(argv[1], "mutate") == 0;
+
+  string reference_file, output_file;
+  double size_mb = 0;
+  uint64_t seed = 1;
+  MutationOptions options;
+  for (int i = 2; i < argc; i += 2) {
+    if (i + 1 >= argc) {
+      show_help_message("Missing value for argument " + string(argv[i]));
+      return 1;
+    }
+
+    if (strcmp(argv[i], "-r") == 0) {
+      reference_file = argv[i + 1];
+    } else if (strcmp(argv[i], "-o") == 0) {
+      output_file = argv[i + 1];
+    } else if (strcmp(argv[i], "-s") == 0) {
+      size_mb = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--seed") == 0) {
+      seed = strtoull(argv[i + 1], nullptr, 10);
+    } else if (strcmp(argv[i], "--snp") == 0) {
+      options.snp_rate = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--indel") == 0) {
+      options.indel_rate = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--inversions") == 0) {
+      options.inversions = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--translocations") == 0) {
+      options.translocations = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--n-gaps") == 0) {
+      options.n_gap_fraction = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--soft-mask") == 0) {
+      options.soft_mask_fraction = atof(argv[i + 1]);
+    } else if (strcmp(argv[i], "--iupac") == 0) {
+      options.iupac_rate = atof(argv[i + 1]);
+    } else {
+      show_help_message("Invalid arguments.");
+      return 1;
+    }
+  }
+
+  if (output_file.empty() || (mutate && reference_file.empty()) ||
+      (!mutate && size_mb <= 0)) {
+    show_help_message("Invalid number of arguments.");
+    return 1;
+  }
+
+  rng_state = seed;
+  try {
+    if (!mutate) {
+      int64_t size = (int64_t)(size_mb * 1000000);
+      write_fasta(output_file,
+                  "synthetic reference " + to_string(size) + " bp seed " +
+                      to_string(seed),
+                  generate_reference(size));
+    } else {
+      string header;
+      string reference = load_bases(reference_file, header);
+      rearrange(reference, options);
+      string target = mutate_bases(reference, options);
+      reference = string();
+      add_masks(target, options);
+      write_fasta(output_file, "mutated " + header, target);
+    }
+  } catch (const exception& e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  return 0;
+}
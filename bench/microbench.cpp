@@ -0,0 +1,381 @@
+// Microbenchmarks of the compressor and decompressor kernels
+//
+// Both programs and the genome generator are compiled into this binary,
+// each in its own namespace, so the kernels run exactly as they do in the
+// tools. Every system header they use is included first, the include
+// guards then keep the standard library out of the namespaces
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace compressor {
+#include "../compress_hirgc.cpp"
+}
+
+namespace decompressor {
+#include "../decompress_hirgc.cpp"
+}
+
+namespace generator {
+#include "generate_genome.cpp"
+}
+
+using namespace std;
+
+const int MICROBENCH_K = 20;
+const int64_t DEFAULT_BASES = 4000000;
+const int DEFAULT_WARMUP = 1;
+const int DEFAULT_REPETITIONS = 5;
+const uint64_t MICROBENCH_SEED = 48;
+const char REFERENCE_FILE[] = "microbench_ref.fna";
+const char TARGET_FILE[] = "microbench_tar.fna";
+const char RECONSTRUCTED_FILE[] = "reconstructed_sequence.fna";
+
+struct BenchOptions {
+  int64_t bases = DEFAULT_BASES;
+  int warmup = DEFAULT_WARMUP;
+  int repetitions = DEFAULT_REPETITIONS;
+};
+
+// Index layouts whose build and seed lookup are timed, the minimizer
+// layout seeds from target minimizers instead of single lookups
+const pair<compressor::IndexLayout, const char*> INDEX_LAYOUTS[] = {
+    {compressor::INDEX_TAGGED, "tagged"},
+    {compressor::INDEX_CSR, "csr"},
+    {compressor::INDEX_FM, "sa"}};
+
+BenchOptions options;
+
+void show_help_message(string reason) {
+  /**
+   * Display an error message along with usage instructions
+   */
+  cout << "Error: " << reason << endl;
+  cout << "Usage: ./microbench [-n <bases>] [-w <warmup_runs>] "
+          "[-r <repetitions>]"
+       << endl;
+}
+
+template <typename Kernel>
+void time_kernel(const string& name, int64_t bases, Kernel kernel) {
+  /**
+   * Run a kernel warmup times untimed, then time every repetition and
+   * print the median and fastest run in nanoseconds per base
+   */
+  for (int i = 0; i < options.warmup; ++i) {
+    kernel();
+  }
+
+  vector<double> samples;
+  for (int i = 0; i < options.repetitions; ++i) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    kernel();
+    int64_t elapsed = chrono::duration_cast<chrono::nanoseconds>(
+                          chrono::steady_clock::now() - start)
+                          .count();
+    samples.push_back((double)elapsed / bases);
+  }
+  sort(samples.begin(), samples.end());
+
+  printf("%-22s %12lld %14.3f %14.3f\n", name.c_str(), (long long)bases,
+         samples[samples.size() / 2], samples[0]);
+  fflush(stdout);
+}
+
+void write_inputs() {
+  /**
+   * Write the fixed-seed reference and a target derived from it with
+   * SNPs, short indels and inversions, so matches run on both strands
+   * The target has no N runs, masks or IUPAC codes, its cleaned sequence
+   * is then the whole target
+   */
+  generator::rng_state = MICROBENCH_SEED;
+  string reference = generator::generate_reference(options.bases);
+  generator::write_fasta(REFERENCE_FILE, "microbench reference", reference);
+
+  generator::MutationOptions mutation;
+  mutation.snp_rate = 0.001;
+  mutation.indel_rate = 0.0002;
+  mutation.inversions = max<int64_t>(1, options.bases / 1000000);
+  generator::rearrange(reference, mutation);
+  generator::write_fasta(TARGET_FILE, "microbench target",
+                         generator::mutate_bases(reference, mutation));
+}
+
+template <typename Pos>
+int64_t match_target() {
+  /**
+   * Greedy parse of the whole target: look up the seed at every literal
+   * position and jump over every match found, as the compressor does
+   * without lazy matching and indel search
+   */
+  int64_t size = compressor::target_seq_encoded.size();
+  int64_t covered = 0;
+  int64_t tar_pos = 0;
+  while (tar_pos < size) {
+    int64_t ref_pos;
+    int64_t length;
+    bool reverse;
+    compressor::find_longest_match<MICROBENCH_K, Pos>(tar_pos, ref_pos,
+                                                      length, reverse);
+    if (length >= MICROBENCH_K) {
+      tar_pos += length;
+      covered += length;
+    } else {
+      tar_pos++;
+    }
+  }
+  return covered;
+}
+
+void build_record_streams() {
+  /**
+   * Fill the decoder record streams with the greedy parse of the target,
+   * the same values load_container() would decode from a container
+   */
+  using decompressor::streams;
+  for (int id = 0; id < decompressor::STREAM_COUNT; ++id) {
+    streams[id].symbols.clear();
+    streams[id].numbers.clear();
+  }
+  vector<uint8_t>& flags = streams[decompressor::STREAM_RECORD_FLAGS].symbols;
+  vector<uint8_t>& bases = streams[decompressor::STREAM_LITERAL_BASES].symbols;
+  const compressor::HugeVector<int>& target = compressor::target_seq_encoded;
+
+  int64_t size = target.size();
+  int64_t tar_pos = 0;
+  int64_t literal_start = 0;
+  int64_t prev_ref_pos = 0;
+  auto add_literals = [&](int64_t end) {
+    if (end > literal_start) {
+      flags.push_back(0);
+      streams[decompressor::STREAM_LITERAL_RUNS].numbers.push_back(
+          end - literal_start);
+      bases.insert(bases.end(), target.begin() + literal_start,
+                   target.begin() + end);
+    }
+  };
+
+  while (tar_pos < size) {
+    int64_t ref_pos;
+    int64_t length;
+    bool reverse;
+    compressor::find_longest_match<MICROBENCH_K, int32_t>(tar_pos, ref_pos,
+                                                          length, reverse);
+    if (length < MICROBENCH_K) {
+      tar_pos++;
+      continue;
+    }
+
+    add_literals(tar_pos);
+    flags.push_back(reverse ? 3 : 1);
+    streams[decompressor::STREAM_REF_DELTAS].numbers.push_back(
+        (uint64_t)(ref_pos - prev_ref_pos));
+    streams[decompressor::STREAM_MATCH_LENGTHS].numbers.push_back(
+        length - MICROBENCH_K);
+    streams[decompressor::STREAM_INSERTED_LENGTHS].numbers.push_back(0);
+    prev_ref_pos = reverse ? ref_pos - length : ref_pos + length;
+    tar_pos += length;
+    literal_start = tar_pos;
+  }
+  add_literals(size);
+}
+
+string read_file(const string& filename) {
+  /**
+   * Whole file as a string, for the roundtrip checks
+   */
+  ifstream file(filename, ios::binary);
+  if (!file) {
+    throw runtime_error("Cannot open file: " + filename);
+  }
+  stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+void run_benchmarks() {
+  /**
+   * Time every kernel on the generated pair, the kernels run in pipeline
+   * order so each one finds the state the previous ones left behind
+   */
+  compressor::initialize_structures();
+  compressor::apply_compression_level(compressor::DEFAULT_COMPRESSION_LEVEL);
+  compressor::options.kmer_length = MICROBENCH_K;
+  compressor::options.stats_format = compressor::STATS_JSON;  // quiet
+
+  // FASTA parsing, the reference is cleaned and 2-bit encoded while it is
+  // read, the target keeps its characters and line lengths
+  write_inputs();
+  time_kernel("fasta_parse_reference", options.bases, [] {
+    compressor::ref_seq.clear();
+    compressor::ref_seq_encoded.clear();
+    compressor::load_sequence(REFERENCE_FILE, compressor::ref_seq,
+                              compressor::ref_seq_encoded, false);
+  });
+  time_kernel("fasta_parse_target", options.bases, [] {
+    compressor::target_seq.clear();
+    compressor::line_lengths.clear();
+    compressor::load_sequence(TARGET_FILE, compressor::target_seq,
+                              compressor::target_seq_encoded, true);
+  });
+  compressor::process_target_sequence();
+  int64_t target_bases = compressor::target_seq_encoded.size();
+
+  // Index build and seed lookup with extension per layout
+  for (const auto& layout : INDEX_LAYOUTS) {
+    compressor::options.index_layout = layout.first;
+    time_kernel(string("index_build_") + layout.second,
+                compressor::ref_seq_encoded.size(), [] {
+                  compressor::build_hash_table<MICROBENCH_K, int32_t>(
+                      compressor::InputFileNames());
+                });
+    time_kernel(string("seed_extend_") + layout.second, target_bases,
+                [] { match_target<int32_t>(); });
+  }
+  compressor::options.index_layout = compressor::INDEX_TAGGED;
+  compressor::build_hash_table<MICROBENCH_K, int32_t>(
+      compressor::InputFileNames());
+
+  // Literal bases through the stream codec and the rANS coder, then back
+  compressor::StreamBlock block;
+  time_kernel("literal_encode", target_bases, [&block] {
+    block.id = compressor::STREAM_LITERAL_BASES;
+    block.count = 0;
+    block.bytes.clear();
+    for (int base : compressor::target_seq_encoded) {
+      compressor::put_value(block, base);
+    }
+    compressor::entropy_code_block(block);
+  });
+
+  decompressor::initialize_structures();
+  decompressor::StreamBlockEntry entry = {
+      decompressor::STREAM_LITERAL_BASES, decompressor::CODEC_PACKED_2BIT,
+      (uint32_t)block.entropy, block.count, 0, block.bytes.size()};
+  decompressor::DecodedStream literals;
+  literals.symbols.resize(block.count);
+  time_kernel("literal_decode", target_bases, [&] {
+    decompressor::decode_block(block.bytes.data(), entry, literals, 0);
+  });
+
+  // Decoder record application on the records of a greedy parse
+  build_record_streams();
+  decompressor::ref_seq.assign(compressor::ref_seq.begin(),
+                               compressor::ref_seq.end());
+  decompressor::kmer_length = MICROBENCH_K;
+  time_kernel("record_apply", target_bases, [] {
+    decompressor::target_seq.clear();
+    decompressor::ref_seq_position = 0;
+    decompressor::decompress_target_sequence(decompressor::target_seq);
+  });
+  if (!equal(decompressor::target_seq.begin(), decompressor::target_seq.end(),
+             compressor::target_seq.begin()) ||
+      decompressor::target_seq.size() != compressor::target_seq.size()) {
+    throw runtime_error("Record application does not reproduce the target");
+  }
+
+  // FASTA writing with the line layout of the target
+  decompressor::header = compressor::header;
+  for (const compressor::LineLength& line : compressor::line_lengths) {
+    decompressor::streams[decompressor::STREAM_LINE_LENGTHS].numbers.push_back(
+        line.length);
+    decompressor::streams[decompressor::STREAM_LINE_LENGTHS].numbers.push_back(
+        line.repeat_count);
+  }
+  time_kernel("fasta_write", target_bases,
+              [] { decompressor::write_reconstructed_sequence_to_file(); });
+  if (read_file(RECONSTRUCTED_FILE) != read_file(TARGET_FILE)) {
+    throw runtime_error("Written FASTA does not match the target");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  /**
+   * Times the kernels of both programs in isolation on a fixed-seed
+   * reference and target, repeated runs on the same machine are directly
+   * comparable, so SIMD and layout changes can be judged kernel by kernel
+   * The inputs are generated in a scratch directory that is removed again
+   */
+  if (argc % 2 == 0) {
+    show_help_message("Invalid number of arguments.");
+    return 1;
+  }
+  for (int i = 1; i < argc; i += 2) {
+    if (strcmp(argv[i], "-n") == 0) {
+      options.bases = atoll(argv[i + 1]);
+    } else if (strcmp(argv[i], "-w") == 0) {
+      options.warmup = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "-r") == 0) {
+      options.repetitions = atoi(argv[i + 1]);
+    } else {
+      show_help_message("Invalid arguments.");
+      return 1;
+    }
+  }
+  if (options.bases < 1000 || options.warmup < 0 || options.repetitions < 1) {
+    show_help_message("Invalid arguments.");
+    return 1;
+  }
+
+  char scratch[] = "/tmp/hirgc_microbench_XXXXXX";
+  if (mkdtemp(scratch) == nullptr || chdir(scratch) != 0) {
+    cerr << "Error: cannot create a scratch directory" << endl;
+    return 1;
+  }
+
+  printf("%-22s %12s %14s %14s\n", "kernel", "bases", "median_ns/base",
+         "min_ns/base");
+  int status = 0;
+  try {
+    run_benchmarks();
+  } catch (const exception& e) {
+    cerr << "Error: " << e.what() << endl;
+    status = 1;
+  }
+
+  unlink(REFERENCE_FILE);
+  unlink(TARGET_FILE);
+  unlink(RECONSTRUCTED_FILE);
+  rmdir(scratch);
+  return status;
+}
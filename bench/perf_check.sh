@@ -0,0 +1,146 @@
+#!/bin/sh
+# Performance regression gate run by make perf-check
+#
+# Runs the benchmark suite on the 5 MB genomes PERF_RUNS times, takes the
+# median of every column per scenario and compares throughput, ratio and
+# peak RSS with the checked-in baseline. Prints every compared metric and
+# fails when one of them is outside its tolerance or a roundtrip failed
+#
+#   PERF_RUNS             runs per scenario, medians are compared (default 3)
+#   PERF_SPEED_TOLERANCE  allowed throughput drop as a fraction (default 0.25)
+#   PERF_RATIO_TOLERANCE  allowed compression ratio drop (default 0.01)
+#   PERF_RSS_TOLERANCE    allowed peak RSS growth (default 0.2)
+#   PERF_BASELINE         baseline table (default bench/baseline.csv)
+#   PERF_UPDATE=1         write the medians as the new baseline instead
+#   BENCH_DIR             generated genomes and scratch files
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+RUNS=${PERF_RUNS:-3}
+BASELINE=${PERF_BASELINE:-$ROOT/bench/baseline.csv}
+SCRATCH=$(mktemp -d)
+trap 'rm -rf "$SCRATCH"' EXIT
+
+run=1
+while [ "$run" -le "$RUNS" ]; do
+  BENCH_SIZES=5 BENCH_ARGS="" BENCH_OUTPUT=$SCRATCH/run_$run.csv \
+    sh "$ROOT/bench/run_bench.sh" > /dev/null
+  run=$((run + 1))
+done
+
+# Median of every numeric column per scenario and size, a roundtrip counts
+# as failed when any run failed
+awk -F, 'FNR == 1 {
+    header = $0
+    columns = NF
+    next
+  }
+  {
+    key = $1 "," $2
+    if (!(key in runs)) {
+      order[++keys] = key
+    }
+    n = ++runs[key]
+    for (i = 3; i < columns; i++) {
+      values[key, i, n] = $i
+    }
+    if ($columns != "ok") {
+      failed[key] = 1
+    }
+  }
+  END {
+    print header
+    for (k = 1; k <= keys; k++) {
+      key = order[k]
+      n = runs[key]
+      line = key
+      for (i = 3; i < columns; i++) {
+        for (a = 1; a <= n; a++) {
+          sorted[a] = values[key, i, a] + 0
+        }
+        for (a = 2; a <= n; a++) {
+          v = sorted[a]
+          for (b = a - 1; b >= 1 && sorted[b] > v; b--) {
+            sorted[b + 1] = sorted[b]
+          }
+          sorted[b + 1] = v
+        }
+        line = line "," sorted[int((n + 1) / 2)]
+      }
+      print line "," (key in failed ? "failed" : "ok")
+    }
+  }' "$SCRATCH"/run_*.csv > "$SCRATCH/current.csv"
+
+if [ "$PERF_UPDATE" = 1 ]; then
+  cp "$SCRATCH/current.csv" "$BASELINE"
+  echo "Baseline written to $BASELINE"
+  cat "$BASELINE"
+  exit 0
+fi
+
+if [ ! -f "$BASELINE" ]; then
+  echo "No baseline at $BASELINE, create one with make perf-baseline"
+  exit 1
+fi
+
+# Direction of every gated metric: higher is better for throughput and
+# ratio, lower for memory
+awk -F, -v speed="${PERF_SPEED_TOLERANCE:-0.25}" \
+  -v ratio="${PERF_RATIO_TOLERANCE:-0.01}" \
+  -v rss="${PERF_RSS_TOLERANCE:-0.2}" 'FNR == 1 {
+    for (i = 1; i <= NF; i++) {
+      column[FILENAME, $i] = i
+    }
+    next
+  }
+  FILENAME == ARGV[1] {
+    baseline[$1 "," $2] = $0
+    order[++keys] = $1 "," $2
+    next
+  }
+  {
+    current[$1 "," $2] = $0
+  }
+  function check(key, metric, tolerance, higher_is_better,
+                 base_fields, current_fields, old, new, change, status) {
+    split(baseline[key], base_fields, ",")
+    split(current[key], current_fields, ",")
+    old = base_fields[column[ARGV[1], metric]]
+    new = current_fields[column[ARGV[2], metric]]
+    change = old > 0 ? (new - old) / old : 0
+    status = "ok"
+    if ((higher_is_better && change < -tolerance) ||
+        (!higher_is_better && change > tolerance)) {
+      status = "REGRESSED"
+      regressions++
+    }
+    printf "%-12s %-24s %14.2f %14.2f %+8.1f%%  %s\n", key, metric, old,
+           new, change * 100, status
+  }
+  END {
+    printf "%-12s %-24s %14s %14s %9s  %s\n", "scenario", "metric",
+           "baseline", "current", "change", "status"
+    for (k = 1; k <= keys; k++) {
+      key = order[k]
+      if (!(key in current)) {
+        printf "%-12s missing from the current run\n", key
+        regressions++
+        continue
+      }
+      split(current[key], fields, ",")
+      if (fields[column[ARGV[2], "roundtrip"]] != "ok") {
+        printf "%-12s roundtrip failed\n", key
+        regressions++
+      }
+      check(key, "ratio", ratio, 1)
+      check(key, "compress_mb_s", speed, 1)
+      check(key, "decompress_mb_s", speed, 1)
+      check(key, "compress_peak_rss_kb", rss, 0)
+      check(key, "decompress_peak_rss_kb", rss, 0)
+    }
+    if (regressions) {
+      printf "\n%d regression(s) against the baseline\n", regressions
+      exit 1
+    }
+    print "\nNo regressions against the baseline"
+  }' "$BASELINE" "$SCRATCH/current.csv"
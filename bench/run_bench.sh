@@ -0,0 +1,107 @@
+#!/bin/sh
+# Benchmark suite run by make bench
+#
+# For every size in BENCH_SIZES (MB) a synthetic reference is generated and
+# one target per scenario is derived from it, the sample pair ref.fna and
+# tar.fna is always included
+# Prints one CSV row per scenario and writes the table to BENCH_OUTPUT
+#
+#   BENCH_SIZES   reference sizes in MB (default "5 50", up to 3000)
+#   BENCH_DIR     generated genomes and scratch files (default bench/data)
+#   BENCH_OUTPUT  CSV table (default bench/results.csv)
+#   BENCH_ARGS    extra compressor arguments, for example "-i sa -9"
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SIZES=${BENCH_SIZES:-"5 50"}
+DATA=${BENCH_DIR:-$ROOT/bench/data}
+OUTPUT=${BENCH_OUTPUT:-$ROOT/bench/results.csv}
+GENERATOR=$ROOT/bench/generate_genome
+WORK=$DATA/run
+
+# Scenario name and mutation options, seeds are fixed so every run uses
+# the same genomes
+SCENARIOS="snp|--snp 0.001
+indel|--snp 0.001 --indel 0.0002
+divergent|--snp 0.01 --indel 0.002
+structural|--snp 0.001 --indel 0.0002 --inversions 20 --translocations 20
+assembly|--snp 0.001 --indel 0.0002 --n-gaps 0.02 --soft-mask 0.4 --iupac 0.0002"
+
+TABLE=$(mktemp)
+trap 'rm -f "$TABLE"' EXIT
+
+mkdir -p "$DATA" "$WORK"
+
+# Compress and decompress one pair in the scratch directory and print its
+# CSV row
+run_scenario() {
+  name=$1
+  size=$2
+  reference=$3
+  target=$4
+
+  cd "$WORK"
+  rm -f compressed.hirgc reconstructed_sequence.fna
+  # shellcheck disable=SC2086
+  "$ROOT/compress_hirgc" -r "$reference" -t "$target" --stats json \
+    $BENCH_ARGS > compress.json
+  "$ROOT/decompress_hirgc" -r "$reference" -t compressed.hirgc \
+    > decompress.txt
+  if cmp -s reconstructed_sequence.fna "$target"; then
+    roundtrip=ok
+  else
+    roundtrip=failed
+  fi
+
+  json_field() {
+    sed -n "s/^  \"$1\": \([0-9.]*\),*$/\1/p" compress.json
+  }
+  target_bytes=$(json_field target_bytes)
+  compressed_bytes=$(json_field compressed_bytes)
+  compress_ms=$(json_field wall_ms)
+  compress_rss=$(json_field peak_rss_kb)
+  decompress_ms=$(sed -n \
+    's/^Total decompresion time : \([0-9.]*\) ms.*/\1/p' decompress.txt)
+  decompress_rss=$(sed -n \
+    's/^Peak memory usage:[[:space:]]*\([0-9]*\) kB/\1/p' decompress.txt)
+
+  awk -v name="$name" -v size="$size" -v target="$target_bytes" \
+    -v compressed="$compressed_bytes" -v compress_ms="$compress_ms" \
+    -v decompress_ms="$decompress_ms" -v compress_rss="$compress_rss" \
+    -v decompress_rss="$decompress_rss" -v roundtrip="$roundtrip" 'BEGIN {
+      printf "%s,%s,%d,%d,%.3f,%.2f,%.2f,%d,%d,%s\n", name, size, target,
+             compressed, target / compressed, target / 1000 / compress_ms,
+             target / 1000 / decompress_ms, compress_rss, decompress_rss,
+             roundtrip
+    }'
+  cd "$ROOT"
+}
+
+# The table goes to a scratch file first, a pipe into tee would hide a
+# failed run behind the status of tee, set -e stops before the output is
+# replaced
+{
+  echo "scenario,size_mb,target_bytes,compressed_bytes,ratio," \
+       "compress_mb_s,decompress_mb_s,compress_peak_rss_kb," \
+       "decompress_peak_rss_kb,roundtrip" | tr -d ' '
+
+  run_scenario sample 5 "$ROOT/ref.fna" "$ROOT/tar.fna"
+
+  for size in $SIZES; do
+    reference=$DATA/ref_$size.fna
+    if [ ! -f "$reference" ]; then
+      "$GENERATOR" reference -s "$size" -o "$reference" --seed "$size"
+    fi
+
+    echo "$SCENARIOS" | while IFS='|' read -r name options; do
+      target=$DATA/tar_${size}_$name.fna
+      if [ ! -f "$target" ]; then
+        # shellcheck disable=SC2086
+        "$GENERATOR" mutate -r "$reference" -o "$target" --seed 2 $options
+      fi
+      run_scenario "$name" "$size" "$reference" "$target"
+    done
+  done
+} > "$TABLE"
+cp "$TABLE" "$OUTPUT"
+cat "$OUTPUT"
@@ -0,0 +1,156 @@
+#!/bin/sh
+# Thread and reference size scaling run by make scaling
+#
+# For every size in SCALING_SIZES (MB) a synthetic reference and a target
+# with 0.1% SNPs and 0.02% indels are generated (shared with make bench),
+# then the pair is compressed and decompressed once per thread count
+# Prints one CSV row per run and writes SCALING_OUTPUT.csv and .json
+#
+#   SCALING_SIZES    reference sizes in MB (default "5 50")
+#   SCALING_THREADS  thread counts, the first is the baseline of the
+#                    parallel efficiency (default 1, 2, 4, ... and the
+#                    number of online CPUs)
+#   SCALING_OUTPUT   output path without extension (default bench/scaling)
+#   BENCH_DIR        generated genomes and scratch files (default bench/data)
+#   BENCH_ARGS       extra compressor arguments, for example "-i csr"
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+SIZES=${SCALING_SIZES:-"5 50"}
+OUTPUT=${SCALING_OUTPUT:-$ROOT/bench/scaling}
+DATA=${BENCH_DIR:-$ROOT/bench/data}
+GENERATOR=$ROOT/bench/generate_genome
+WORK=$DATA/run
+
+if [ -z "$SCALING_THREADS" ]; then
+  cpus=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+  SCALING_THREADS=""
+  threads=1
+  while [ "$threads" -lt "$cpus" ]; do
+    SCALING_THREADS="$SCALING_THREADS $threads"
+    threads=$((threads * 2))
+  done
+  SCALING_THREADS="$SCALING_THREADS $cpus"
+fi
+
+TABLE=$(mktemp)
+trap 'rm -f "$TABLE"' EXIT
+
+mkdir -p "$DATA" "$WORK"
+
+# Compress and decompress one pair with the given thread count and print
+# its CSV row, efficiency is relative to the baseline throughputs
+run_threads() {
+  size=$1
+  threads=$2
+  reference=$3
+  target=$4
+
+  cd "$WORK"
+  rm -f compressed.hirgc reconstructed_sequence.fna
+  # shellcheck disable=SC2086
+  "$ROOT/compress_hirgc" -r "$reference" -t "$target" --stats json \
+    --threads "$threads" $BENCH_ARGS > compress.json
+  "$ROOT/decompress_hirgc" -r "$reference" -t compressed.hirgc \
+    --threads "$threads" > decompress.txt
+  if cmp -s reconstructed_sequence.fna "$target"; then
+    roundtrip=ok
+  else
+    roundtrip=failed
+  fi
+
+  json_field() {
+    sed -n "s/^  \"$1\": \([0-9.]*\),*$/\1/p" compress.json
+  }
+  # Wall (1) or CPU (2) time of a phase
+  phase_field() {
+    times='{"wall_ms": \([0-9.]*\), "cpu_ms": \([0-9.]*\)}'
+    sed -n "s/^    \"$1\": $times.*/\\$2/p" compress.json
+  }
+  reference_bytes=$(json_field reference_bytes)
+  target_bytes=$(json_field target_bytes)
+  compressed_bytes=$(json_field compressed_bytes)
+  compress_ms=$(json_field wall_ms)
+  compress_rss=$(json_field peak_rss_kb)
+  index_ms=$(phase_field index_build 1)
+  index_cpu_ms=$(phase_field index_build 2)
+  decompress_ms=$(sed -n \
+    's/^Total decompresion time : \([0-9.]*\) ms.*/\1/p' decompress.txt)
+  decompress_rss=$(sed -n \
+    's/^Peak memory usage:[[:space:]]*\([0-9]*\) kB/\1/p' decompress.txt)
+
+  awk -v size="$size" -v threads="$threads" -v base="$baseline" \
+    -v reference="$reference_bytes" -v target="$target_bytes" \
+    -v compressed="$compressed_bytes" -v compress_ms="$compress_ms" \
+    -v index_ms="$index_ms" -v index_cpu_ms="$index_cpu_ms" \
+    -v decompress_ms="$decompress_ms" -v compress_rss="$compress_rss" \
+    -v decompress_rss="$decompress_rss" -v roundtrip="$roundtrip" 'BEGIN {
+      compress = target / 1000 / compress_ms
+      decompress = target / 1000 / decompress_ms
+      build = reference / 1000 / index_ms
+      if (base == "") {
+        base = threads " " compress " " decompress " " build
+      }
+      split(base, b, " ")
+      scale = threads / b[1]
+      printf "%s,%d,%d,%d,%d,%.2f,%.3f,%.1f,%.1f,%.2f,%.3f,%.2f,%.3f," \
+             "%d,%d,%s\n", size, threads, reference, target, compressed,
+             compress, compress / b[2] / scale, index_ms, index_cpu_ms,
+             build, build / b[4] / scale, decompress,
+             decompress / b[3] / scale, compress_rss, decompress_rss,
+             roundtrip
+      print base > "baseline"
+    }'
+  baseline=$(cat baseline)
+  cd "$ROOT"
+}
+
+# Same scratch table as make bench, a failed run must not leave a
+# truncated table behind a zero exit status
+{
+  echo "size_mb,threads,reference_bytes,target_bytes,compressed_bytes," \
+       "compress_mb_s,compress_efficiency,index_build_ms," \
+       "index_build_cpu_ms,index_build_mb_s,index_build_efficiency," \
+       "decompress_mb_s,decompress_efficiency,compress_peak_rss_kb," \
+       "decompress_peak_rss_kb,roundtrip" | tr -d ' '
+
+  for size in $SIZES; do
+    reference=$DATA/ref_$size.fna
+    target=$DATA/tar_${size}_indel.fna
+    if [ ! -f "$reference" ]; then
+      "$GENERATOR" reference -s "$size" -o "$reference" --seed "$size"
+    fi
+    if [ ! -f "$target" ]; then
+      "$GENERATOR" mutate -r "$reference" -o "$target" --seed 2 \
+        --snp 0.001 --indel 0.0002
+    fi
+
+    baseline=""
+    for threads in $SCALING_THREADS; do
+      run_threads "$size" "$threads" "$reference" "$target"
+    done
+  done
+} > "$TABLE"
+cp "$TABLE" "$OUTPUT.csv"
+cat "$OUTPUT.csv"
+
+# Same table as a JSON array of objects, roundtrip stays a string
+awk -F, 'NR == 1 {
+    for (i = 1; i <= NF; i++) {
+      names[i] = $i
+    }
+    print "["
+    next
+  }
+  {
+    printf "%s  {", (NR > 2 ? ",\n" : "")
+    for (i = 1; i <= NF; i++) {
+      value = names[i] == "roundtrip" ? "\"" $i "\"" : $i
+      printf "%s\"%s\": %s", (i > 1 ? ", " : ""), names[i], value
+    }
+    printf "}"
+  }
+  END {
+    print ""
+    print "]"
+  }' "$OUTPUT.csv" > "$OUTPUT.json"
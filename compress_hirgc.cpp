@@ -1,74 +1,566 @@
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <cctype>
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
+#include <ctime>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <map>
+#include <mutex>
+#include <new>
+#include <queue>
 #include <set>
 #include <stdexcept>
+#include <thread>
 #include <tuple>
 #include <unordered_map>
 #include <vector>
 
 using namespace std;
 
-const int MAX_SEQ_LENGTH = 1 << 28;
-const int KMER_LENGTH = 20;
-const int HASH_TABLE_SIZE = 1 << 28;
-const int HASH_TABLE_BIT = 28;
+const int DEFAULT_KMER_LENGTH = 20;
+const int BUCKET_SLOTS = 8;
+const int BUCKET_FILL = 6;        // average filled slots per bucket
+const int MAX_BUCKET_PROBES = 8;  // buckets of a tagged probe sequence
+const int CSR_BUCKET_FILL = 4;    // average positions per CSR bucket
+// Largest indexed text that still fits 32 bit positions
+const int64_t MAX_NARROW_POSITION = INT32_MAX;
+const char INDEX_FILE_MAGIC[8] = {'H', 'I', 'R', 'G', 'C', 'I', 'D', 'X'};
+const uint32_t INDEX_FILE_VERSION = 4;
+const int DEFAULT_MINIMIZER_WINDOW = 10;
+const int OCC_SAMPLE_RATE = 64;  // BWT positions per rank block
+const int FM_PREFIX_LENGTH = 10;  // bases resolved by the interval table
+const uint64_t KMER_HASH_MULTIPLIER = 0x9E3779B97F4A7C15ULL;
 const int INITIAL_BUFFER_SIZE = 1024;
 const int BITS_PER_BYTE = 8;
 const int MAX_DELTA_BITS = 32;
+const int DEFAULT_COMPRESSION_LEVEL = 6;
+const int HISTOGRAM_BINS = 40;  // log2 bins, bin b counts [2^(b-1), 2^b)
+
+// Matcher counters cost nothing unless built with make COUNTERS=1
+#ifdef HIRGC_COUNTERS
+const bool MATCHER_COUNTERS = true;
+#else
+const bool MATCHER_COUNTERS = false;
+#endif
+const int DECODE_SPEED_MIN_MATCH = 32;  // shortest match record, decode profile
+const int LOOKUP_BATCH = 16;
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+const int RECORD_BLOCK_SIZE = 4096;        // records handed over at once
+const int PIPELINE_RING_SIZE = 64;         // blocks in flight between stages
+const size_t MIN_BLOCK_SIZE = 4 << 10;
+const char CONTAINER_MAGIC[8] = {'H', 'I', 'R', 'G', 'C', 'S', 'T', 'R'};
+const uint32_t CONTAINER_VERSION = 3;
+const int RANS_PROB_BITS = 12;
+const uint32_t RANS_PROB_SCALE = 1 << RANS_PROB_BITS;
+const uint32_t RANS_LOWER_BOUND = 1 << 16;  // states stay in [L, L << 16)
+const int RANS_LANES = 8;                    // interleaved rANS states
+const size_t RANS_MIN_BLOCK = 64;  // smaller blocks are stored as they are
+const int MAX_NUMA_NODES = 64;
+const int NUMA_POLICY_PREFERRED = 1;   // Linux MPOL_PREFERRED
+const int NUMA_POLICY_INTERLEAVE = 3;  // Linux MPOL_INTERLEAVE
 
 struct InputFileNames {
   string reference_file;
   string target_file;
+  string index_save_file;
+  string index_load_file;
+};
+
+enum IndexLayout { INDEX_TAGGED, INDEX_CSR, INDEX_MINIMIZER, INDEX_FM };
+
+// Auto maps explicit huge pages when the system has them reserved and
+// falls back to transparent huge pages
+enum HugePageMode { HUGE_PAGES_AUTO, HUGE_PAGES_TRANSPARENT, HUGE_PAGES_OFF };
+
+// Interleave spreads the index pages over all nodes, local pins the process
+// to one node and prefers that node's memory for the index
+enum NumaMode { NUMA_OFF, NUMA_INTERLEAVE, NUMA_LOCAL };
+
+// The decode speed profile is for archives decompressed many times, it
+// parses as hard as level 9 but emits only long match records so decoding
+// is mostly copying from the reference, and keeps static rANS as the only
+// entropy coder
+enum FormatProfile { PROFILE_DEFAULT, PROFILE_DECODE_SPEED };
+
+// Text prints the usual report, json replaces it with one JSON object
+enum StatsFormat { STATS_TEXT, STATS_JSON };
+
+// Phases timed for the stats report, they overlap since the target is
+// loaded during the index build and the pipeline stages run concurrently
+enum Phase {
+  PHASE_LOAD,
+  PHASE_MASKS,
+  PHASE_INDEX,
+  PHASE_MATCH,
+  PHASE_ENCODE,
+  PHASE_ENTROPY,
+  PHASE_WRITE,
+  PHASE_COUNT
+};
+
+const char* const PHASE_NAMES[PHASE_COUNT] = {
+    "load",     "mask_extraction", "index_build", "matching",
+    "encoding", "entropy_coding",  "writing"};
+
+// Matcher and coder settings of one compression level, see
+// apply_compression_level()
+struct CompressionLevel {
+  int index_step;        // every index_step-th reference k-mer is indexed
+  int max_candidates;    // candidates extended per k-mer, 0 for all
+  int lazy_depth;        // later start positions tried for a longer match
+  int max_indel_length;  // SNP/indel continuation search, 0 disables it
+  size_t block_size;     // stream bytes per coded block
+};
+
+// Level 1 is the fastest, 9 the smallest, 6 is the default
+// The index build dominates the compression time, so the fast levels
+// index a sample of the reference, a match then starts up to
+// index_step - 1 bases late
+const CompressionLevel COMPRESSION_LEVELS[9] = {
+    {16, 4, 0, 1, 256 << 10},  {8, 8, 0, 2, 256 << 10},
+    {4, 16, 0, 4, 512 << 10},  {3, 32, 0, 8, 1 << 20},
+    {2, 32, 0, 8, 1 << 20},    {1, 64, 0, 8, 1 << 20},
+    {1, 256, 1, 8, 4 << 20},   {1, 0, 2, 12, 4 << 20},
+    {1, 0, 4, 16, 16 << 20}};
+
+struct CompressionOptions {
+  IndexLayout index_layout = INDEX_CSR;
+  bool index_layout_set = false;  // -i given on the command line
+  int kmer_length = DEFAULT_KMER_LENGTH;
+  int minimizer_window = DEFAULT_MINIMIZER_WINDOW;
+  int position_bits = 32;  // width of stored reference positions
+  HugePageMode huge_pages = HUGE_PAGES_AUTO;
+  NumaMode numa_mode = NUMA_OFF;
+  int numa_node = -1;  // local mode node, -1 for the node of the start CPU
+  int threads = 0;  // entropy coder threads, 0 for one per hardware thread
+  int level = DEFAULT_COMPRESSION_LEVEL;
+  int index_step = 1;  // every index_step-th reference k-mer is indexed
+  int max_candidates = 0;
+  int lazy_depth = 0;
+  int max_indel_length = 8;
+  size_t block_size = 0;  // 0 until set by --block-size or the level
+  FormatProfile profile = PROFILE_DEFAULT;
+  int min_match_length = 0;  // shorter matches stay literals, 0 for k
+  StatsFormat stats_format = STATS_TEXT;
+};
+
+// Wall and CPU time of a phase, summed over the threads that ran it
+struct PhaseTime {
+  atomic<int64_t> wall_ns;
+  atomic<int64_t> cpu_ns;
+};
+
+// Totals of the written blocks of one stream, bytes in is the codec
+// output and bytes out what was stored after entropy coding
+struct StreamStats {
+  uint64_t blocks = 0;
+  uint64_t values = 0;
+  uint64_t bytes_in = 0;
+  uint64_t bytes_out = 0;
+};
+
+// Values counted in power of two bins, bin 0 holds the zeros
+struct Histogram {
+  uint64_t bins[HISTOGRAM_BINS] = {0};
+
+  void add(uint64_t value) {
+    int bin = value ? 64 - __builtin_clzll(value) : 0;
+    bins[min(bin, HISTOGRAM_BINS - 1)]++;
+  }
+};
+
+// Hot path counters of the matcher, only updated when MATCHER_COUNTERS is
+// set, the matcher runs on one thread
+struct MatcherCounters {
+  uint64_t hash_lookups = 0;        // k-mer index and FM-index lookups
+  uint64_t candidates_walked = 0;   // positions with a matching tag
+  uint64_t tag_rejected = 0;        // positions filtered out by the tag
+  uint64_t verify_rejected = 0;     // matching tag, shorter than k
+  uint64_t bases_compared = 0;      // base comparisons while extending
+  Histogram chain_lengths;          // candidates walked per lookup
+  Histogram match_lengths;
+  Histogram literal_runs;
+};
+
+// Matcher totals for the final report
+struct MatchStats {
+  int64_t matched_bases = 0;
+  int64_t mismatched_bases = 0;
+  int64_t reverse_matched_bases = 0;
+  int64_t match_records = 0;
+  int64_t literal_records = 0;
+  int64_t indel_records = 0;
+  uint64_t compressed_size = 0;
+};
+
+// Bytes of the large arrays advised for transparent huge pages, for the
+// final report, the target is loaded on another thread
+struct HugePageUsage {
+  atomic<size_t> advised_bytes{0};  // MADV_HUGEPAGE
+};
+
+// Canonical k-mer selected as a window minimizer, reverse when the
+// reverse complement is the smaller of the two strands
+struct Minimizer {
+  int64_t pos;
+  bool reverse;
+  uint64_t kmer;
 };
 
 struct PositionRange {
-  int start;
-  int length;
+  int64_t start;
+  int64_t length;
 };
 
 struct SpecialChar {
-  int pos;
+  int64_t pos;
   char ch;
 };
 
 struct Match {
-  int ref_pos;
-  int tar_pos;
-  int length;
+  int64_t ref_pos;
+  int64_t tar_pos;
+  int64_t length;
+  bool reverse;
+};
+
+// Hashed and prefetched lookups of consecutive target positions, a slot
+// is resolved only when the matcher reaches its position
+struct LookupBatch {
+  int64_t start = 0;
+  int64_t end = 0;
+  uint64_t buckets[LOOKUP_BATCH][2];
+  uint16_t tags[LOOKUP_BATCH][2];
+};
+
+enum RecordType { RECORD_LITERALS, RECORD_MATCH };
+
+// Streams of the container, every one is coded on its own
+enum StreamId {
+  STREAM_HEADER,            // FASTA header bytes
+  STREAM_LINE_LENGTHS,      // length, repeat count pairs
+  STREAM_LOWERCASE_RANGES,  // gap, length pairs
+  STREAM_N_RANGES,          // gap, length pairs
+  STREAM_SPECIAL_GAPS,      // bases before each special character
+  STREAM_SPECIAL_CHARS,     // the special characters themselves
+  STREAM_RECORD_FLAGS,      // per record, bit 0 match, bit 1 reverse
+  STREAM_REF_DELTAS,        // match start minus end of the previous match
+  STREAM_MATCH_LENGTHS,     // match length minus k
+  STREAM_INSERTED_LENGTHS,  // bases inserted before each match
+  STREAM_LITERAL_RUNS,      // length of each literal run
+  STREAM_LITERAL_BASES,     // literal and inserted bases
+  STREAM_COUNT
+};
+
+enum StreamCodec {
+  CODEC_RAW,            // one byte per value
+  CODEC_VARINT,         // LEB128
+  CODEC_ZIGZAG_VARINT,  // LEB128 of signed values folded to unsigned
+  CODEC_PACKED_2BIT     // four values per byte
+};
+
+// Entropy stage applied to the codec output of a block
+enum EntropyCoder { ENTROPY_NONE, ENTROPY_RANS };
+
+const StreamCodec STREAM_CODECS[STREAM_COUNT] = {
+    CODEC_RAW,         CODEC_VARINT,        CODEC_VARINT,
+    CODEC_VARINT,      CODEC_VARINT,        CODEC_RAW,
+    CODEC_PACKED_2BIT, CODEC_ZIGZAG_VARINT, CODEC_VARINT,
+    CODEC_VARINT,      CODEC_VARINT,        CODEC_PACKED_2BIT};
+
+const char* const STREAM_NAMES[STREAM_COUNT] = {
+    "header",       "line_lengths",     "lowercase_ranges", "n_ranges",
+    "special_gaps", "special_chars",    "record_flags",     "ref_deltas",
+    "match_lengths", "inserted_lengths", "literal_runs",    "literal_bases"};
+
+// Coded block of one stream, count is the number of values it holds
+struct StreamBlock {
+  StreamId id;
+  uint64_t count;
+  string bytes;
+  EntropyCoder entropy;
+  uint64_t raw_size;  // codec bytes before entropy coding
+};
+
+// Directory entry of a block written to the container
+struct StreamBlockEntry {
+  uint32_t id;
+  uint32_t codec;
+  uint32_t entropy;
+  uint64_t count;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// One record of the compressed stream, literals are a run of the encoded
+// target, a match may carry the bases inserted before it
+struct Record {
+  RecordType type;
+  bool reverse;
+  int64_t ref_delta;
+  int64_t length;
+  int64_t literal_start;
+  int64_t literal_length;
+};
+
+// Lock-free queue between one producer and one consumer thread
+// Capacity is a power of two, push waits while full and pop while empty
+template <typename T>
+struct SpscRing {
+  vector<T> slots;
+  alignas(64) atomic<size_t> head;  // next slot to pop, consumer owned
+  alignas(64) atomic<size_t> tail;  // next slot to push, producer owned
+  atomic<bool> closed;
+
+  explicit SpscRing(size_t capacity) : slots(capacity) {
+    head = 0;
+    tail = 0;
+    closed = false;
+  }
+
+  void push(T&& item) {
+    size_t t = tail.load(memory_order_relaxed);
+    while (t - head.load(memory_order_acquire) == slots.size()) {
+      this_thread::yield();
+    }
+    slots[t & (slots.size() - 1)] = move(item);
+    tail.store(t + 1, memory_order_release);
+  }
+
+  // Returns false once the ring is closed and drained
+  bool pop(T& item) {
+    size_t h = head.load(memory_order_relaxed);
+    while (h == tail.load(memory_order_acquire)) {
+      if (closed.load(memory_order_acquire) &&
+          h == tail.load(memory_order_acquire)) {
+        return false;
+      }
+      this_thread::yield();
+    }
+    item = move(slots[h & (slots.size() - 1)]);
+    head.store(h + 1, memory_order_release);
+    return true;
+  }
+
+  void close() { closed.store(true, memory_order_release); }
+};
+
+// Fixed set of worker threads running submitted tasks in order of arrival
+struct ThreadPool {
+  vector<thread> workers;
+  queue<function<void()>> tasks;
+  mutex lock;
+  condition_variable ready;
+  bool stopping = false;
+
+  explicit ThreadPool(int count) {
+    for (int i = 0; i < count; ++i) {
+      workers.emplace_back([this]() {
+        while (true) {
+          function<void()> task;
+          {
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard, [this]() { return stopping || !tasks.empty(); });
+            if (tasks.empty()) {
+              return;
+            }
+            task = move(tasks.front());
+            tasks.pop();
+          }
+          task();
+        }
+      });
+    }
+  }
+
+  // Queued tasks still run, the destructor returns once all are done
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+    }
+    ready.notify_all();
+    for (thread& worker : workers) {
+      worker.join();
+    }
+  }
+
+  template <typename T>
+  future<T> submit(function<T()> work) {
+    auto task = make_shared<packaged_task<T()>>(move(work));
+    future<T> result = task->get_future();
+    {
+      lock_guard<mutex> guard(lock);
+      tasks.emplace([task]() { (*task)(); });
+    }
+    ready.notify_one();
+    return result;
+  }
+};
+
+// One cache line of the k-mer table, tag 0 marks an empty slot
+// Pos is the stored position type, int32_t whenever the reference fits
+template <typename Pos>
+struct alignas(64) KmerBucket {
+  uint16_t tags[BUCKET_SLOTS];
+  Pos positions[BUCKET_SLOTS];
+};
+
+// Rank block of the FM-index, base counts before the block and one bit
+// per position for each base
+template <typename Pos>
+struct FmBlock {
+  Pos counts[4];
+  uint64_t masks[4];
+};
+
+void* allocate_huge_pages(size_t bytes);
+void release_huge_pages(void* memory, size_t bytes);
+
+// Allocator for the large, randomly accessed arrays, backs them with 2 MiB
+// pages so a candidate probe does not also miss the TLB
+template <typename T>
+struct HugePageAllocator {
+  typedef T value_type;
+
+  HugePageAllocator() {}
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U>&) {}
+
+  T* allocate(size_t n) { return (T*)allocate_huge_pages(n * sizeof(T)); }
+  void deallocate(T* p, size_t n) { release_huge_pages(p, n * sizeof(T)); }
+};
+
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+  return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T>&, const HugePageAllocator<U>&) {
+  return false;
+}
+
+template <typename T>
+using HugeVector = vector<T, HugePageAllocator<T>>;
+
+// Reference index storage in one of the position widths
+template <typename Pos>
+struct ReferenceIndex {
+  HugeVector<KmerBucket<Pos>> kmer_table;
+  HugeVector<Pos> csr_offsets;
+  HugeVector<uint16_t> csr_tags;
+  HugeVector<Pos> csr_positions;  // minimizer index stores pos << 1 | reverse
+  // FM-index of the reversed reference + separator + reverse complement,
+  // symbols are terminator 0, separator 1 and bases 2..5
+  HugeVector<Pos> fm_suffix_array;
+  HugeVector<FmBlock<Pos>> fm_blocks;
+  HugeVector<Pos> fm_prefix_intervals;  // lo, hi for every prefix k-mer
+  Pos fm_size;
 };
 
 struct LineLength {
-  int length;
-  int repeat_count;
+  int64_t length;
+  int64_t repeat_count;
 };
 
 vector<char> ref_seq;
 vector<char> target_seq;
 vector<char> ref_seq_cleaned;
-vector<char> target_seq_cleaned;
-vector<int> target_seq_encoded;
-vector<int> ref_seq_encoded;
-vector<int> point(HASH_TABLE_SIZE, -1);
-vector<int> loc;
+HugeVector<int> target_seq_encoded;
+HugeVector<int> ref_seq_encoded;
+uint64_t kmer_table_mask;
+int kmer_table_bits;
+vector<Minimizer> target_minimizers;
+uint64_t fm_count[7];  // symbols smaller than each symbol
+CompressionOptions options;
+HugePageUsage huge_page_usage;
+uint64_t numa_node_mask;  // nodes the large arrays are interleaved over
+atomic<size_t> numa_interleaved_bytes(0);
+atomic<size_t> numa_unbound_bytes(0);  // mbind refused, first touch placed
 vector<PositionRange> lowercase_ranges;
 vector<PositionRange> n_ranges;
 vector<SpecialChar> special_chars;
 vector<LineLength> line_lengths;
-vector<int> line_breaks;
 string mismatch_buffer;
 string header;
 unsigned long timer;
 struct timeval timer_start, timer_end;
 int base_to_index[256];
+PhaseTime phase_times[PHASE_COUNT];
+StreamStats stream_stats[STREAM_COUNT];  // written by the writer thread
+MatchStats match_stats;
+MatcherCounters matcher_counters;
+
+// Adds the wall and thread CPU time of its scope to a phase, stop() ends
+// the phase early
+struct PhaseTimer {
+  Phase phase;
+  chrono::steady_clock::time_point wall_start;
+  int64_t cpu_start;
+  bool running = true;
+
+  static int64_t thread_cpu_ns() {
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+  }
+
+  explicit PhaseTimer(Phase timed_phase)
+      : phase(timed_phase),
+        wall_start(chrono::steady_clock::now()),
+        cpu_start(thread_cpu_ns()) {}
+
+  void stop() {
+    if (running) {
+      phase_times[phase].wall_ns +=
+          chrono::duration_cast<chrono::nanoseconds>(
+              chrono::steady_clock::now() - wall_start)
+              .count();
+      phase_times[phase].cpu_ns += thread_cpu_ns() - cpu_start;
+      running = false;
+    }
+  }
+
+  ~PhaseTimer() { stop(); }
+};
+
+ostream& report() {
+  /**
+   * Stream for the text report, output is dropped with --stats json so
+   * stdout only carries the JSON object
+   */
+  static ostream discard(nullptr);
+  return options.stats_format == STATS_TEXT ? cout : discard;
+}
+
+template <typename Pos>
+ReferenceIndex<Pos>& reference_index() {
+  /**
+   * The reference index of position type Pos, only one of the widths is
+   * ever built
+   */
+  static ReferenceIndex<Pos> index;
+  return index;
+}
 
 void show_help_message(string reason) {
   /**
@@ -78,10 +570,214 @@ void show_help_message(string reason) {
    */
   cout << "Error: " << reason << endl;
   cout << "Usage: ./compress_hirgc -r <reference_file_name> -t "
-          "<target_file_name>"
+          "<target_file_name> [-k <kmer_length>] "
+          "[-i tagged|csr|minimizer|sa] [-w <window>] "
+          "[--save-index <index_file>] [--load-index <index_file>] "
+          "[--huge-pages auto|thp|off] "
+          "[--numa off|interleave|local|<node>] "
+          "[--block-size <KiB>] [--threads <count>] [-1 ... -9] "
+          "[--profile default|decode-speed] [--stats text|json]"
        << endl;
 }
 
+void apply_compression_level(int level) {
+  /**
+   * Set the matcher and coder options of a level, an explicit
+   * --block-size is kept
+   * Low levels index a sample of the reference, cap the candidates
+   * extended per lookup and narrow the SNP/indel search, high levels add
+   * lazy matching, a wider indel search and larger blocks
+   */
+  const CompressionLevel& settings = COMPRESSION_LEVELS[level - 1];
+  options.level = level;
+  options.index_step = settings.index_step;
+  options.max_candidates = settings.max_candidates;
+  options.lazy_depth = settings.lazy_depth;
+  options.max_indel_length = settings.max_indel_length;
+  if (options.block_size == 0) {
+    options.block_size = settings.block_size;
+  }
+}
+
+void apply_format_profile() {
+  /**
+   * The decode speed profile takes the parsing settings of the highest
+   * level on top of the chosen one and raises the shortest match record
+   */
+  if (options.profile != PROFILE_DECODE_SPEED) {
+    return;
+  }
+  const CompressionLevel& best = COMPRESSION_LEVELS[8];
+  options.index_step = best.index_step;
+  options.max_candidates = best.max_candidates;
+  options.lazy_depth = best.lazy_depth;
+  options.max_indel_length = best.max_indel_length;
+  options.min_match_length = DECODE_SPEED_MIN_MATCH;
+}
+
+void* allocate_huge_pages(size_t bytes) {
+  /**
+   * Map at least bytes for one of the large arrays, on explicit huge pages
+   * when they are reserved, otherwise on normal pages advised for
+   * transparent huge pages, arrays below one huge page use the heap
+   */
+  if (bytes < HUGE_PAGE_SIZE || options.huge_pages == HUGE_PAGES_OFF) {
+    void* memory = nullptr;
+    if (posix_memalign(&memory, 64, max(bytes, (size_t)1)) != 0) {
+      throw bad_alloc();
+    }
+    return memory;
+  }
+
+  size_t length = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+  void* memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (options.huge_pages == HUGE_PAGES_AUTO) {
+    memory = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  }
+#endif
+
+  if (memory == MAP_FAILED) {
+    memory = mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+      throw bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (madvise(memory, length, MADV_HUGEPAGE) == 0) {
+      huge_page_usage.advised_bytes += length;
+    }
+#endif
+  }
+
+  // Pages are placed on first touch, so the policy has to be set before
+  // the array is filled
+  if (options.numa_mode == NUMA_INTERLEAVE) {
+    if (syscall(SYS_mbind, memory, length, NUMA_POLICY_INTERLEAVE,
+                &numa_node_mask, MAX_NUMA_NODES + 1, 0) == 0) {
+      numa_interleaved_bytes += length;
+    } else {
+      numa_unbound_bytes += length;
+    }
+  }
+  return memory;
+}
+
+void release_huge_pages(void* memory, size_t bytes) {
+  /**
+   * Release memory from allocate_huge_pages() of the same size
+   */
+  if (bytes < HUGE_PAGE_SIZE || options.huge_pages == HUGE_PAGES_OFF) {
+    free(memory);
+    return;
+  }
+  munmap(memory, (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+}
+
+vector<int> parse_id_list(const string& list) {
+  /**
+   * Parse a kernel id list such as 0-3,8,10-11 into the ids it holds
+   */
+  vector<int> ids;
+  size_t start = 0;
+  while (start < list.size()) {
+    size_t end = list.find(',', start);
+    if (end == string::npos) {
+      end = list.size();
+    }
+    string range = list.substr(start, end - start);
+    size_t dash = range.find('-');
+    if (!range.empty() && isdigit(range[0])) {
+      int first = stoi(range);
+      int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+      for (int id = first; id <= last; ++id) {
+        ids.push_back(id);
+      }
+    }
+    start = end + 1;
+  }
+  return ids;
+}
+
+string read_sysfs_line(const string& path) {
+  /**
+   * First line of a sysfs file, empty when it does not exist
+   */
+  ifstream file(path);
+  string line;
+  getline(file, line);
+  return line;
+}
+
+void setup_numa_placement() {
+  /**
+   * Apply the NUMA mode before any large array is allocated
+   * Interleave sets the node mask used by allocate_huge_pages(), local
+   * pins the process to the CPUs of one node and prefers its memory for
+   * every allocation, threads started later inherit the CPU set
+   */
+  if (options.numa_mode == NUMA_OFF) {
+    return;
+  }
+
+  vector<int> nodes =
+      parse_id_list(read_sysfs_line("/sys/devices/system/node/online"));
+  if (nodes.empty()) {
+    report() << "NUMA: no node information, placement disabled" << endl;
+    options.numa_mode = NUMA_OFF;
+    return;
+  }
+
+  if (options.numa_mode == NUMA_INTERLEAVE) {
+    numa_node_mask = 0;
+    for (int node : nodes) {
+      if (node < MAX_NUMA_NODES) {
+        numa_node_mask |= 1ULL << node;
+      }
+    }
+    report() << "NUMA: interleaving the large arrays over " << nodes.size()
+         << " nodes" << endl;
+    return;
+  }
+
+  // Local mode, default to the node the process was started on
+  int node = options.numa_node;
+  if (node < 0) {
+    string cpu_dir =
+        "/sys/devices/system/cpu/cpu" + to_string(sched_getcpu()) + "/node";
+    for (int candidate : nodes) {
+      if (access((cpu_dir + to_string(candidate)).c_str(), F_OK) == 0) {
+        node = candidate;
+        break;
+      }
+    }
+  }
+  if (find(nodes.begin(), nodes.end(), node) == nodes.end() ||
+      node >= MAX_NUMA_NODES) {
+    throw runtime_error("Unknown NUMA node " + to_string(node));
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (int cpu : parse_id_list(read_sysfs_line(
+           "/sys/devices/system/node/node" + to_string(node) + "/cpulist"))) {
+    CPU_SET(cpu, &cpus);
+  }
+  if (CPU_COUNT(&cpus) == 0 || sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+    throw runtime_error("Cannot pin to NUMA node " + to_string(node));
+  }
+
+  uint64_t node_mask = 1ULL << node;
+  report() << "NUMA: pinned to node " << node << " (" << CPU_COUNT(&cpus)
+       << " CPUs)" << endl;
+  if (syscall(SYS_set_mempolicy, NUMA_POLICY_PREFERRED, &node_mask,
+              MAX_NUMA_NODES + 1) != 0) {
+    report() << "NUMA: memory policy refused, allocations follow first touch"
+         << endl;
+  }
+}
+
 void init_base_index() {
   /**
    * Initialize base to index mapping for time efficient encoding
@@ -95,21 +791,25 @@ void init_base_index() {
   base_to_index['T'] = 3;
 }
 
+uint64_t file_size(const string& filename) {
+  /**
+   * Size of a file in bytes, 0 when it cannot be read
+   */
+  struct stat info;
+  return stat(filename.c_str(), &info) == 0 ? info.st_size : 0;
+}
+
 void initialize_structures() {
   /**
    * Initialize memory structures for genome sequences and buffers
    * @author Lorena Švenjak
    */
-  ref_seq.reserve(MAX_SEQ_LENGTH);
-  target_seq.reserve(MAX_SEQ_LENGTH);
   mismatch_buffer.reserve(INITIAL_BUFFER_SIZE);
-  target_seq_encoded.reserve(MAX_SEQ_LENGTH);
-  ref_seq_encoded.reserve(MAX_SEQ_LENGTH);
   init_base_index();
 }
 
 void load_sequence(const string& filename, vector<char>& sequence,
-                   vector<int>& sequence_encoded, bool is_target) {
+                   HugeVector<int>& sequence_encoded, bool is_target) {
   /**
    * Load genome sequence from FASTA file into memory
    * Store line breaks and header info for target sequence
@@ -120,6 +820,14 @@ void load_sequence(const string& filename, vector<char>& sequence,
     throw runtime_error("Cannot open file: " + filename);
   }
 
+  // The file size bounds the base count, so the sequences never grow and
+  // only the pages the bases are written to get mapped
+  uint64_t capacity = file_size(filename);
+  sequence.reserve(capacity);
+  if (!is_target) {
+    sequence_encoded.reserve(capacity);
+  }
+
   string line;
 
   // Read header line
@@ -127,12 +835,11 @@ void load_sequence(const string& filename, vector<char>& sequence,
   header = line;
 
   while (getline(file, line)) {
-    int length = 0;
+    int64_t length = 0;
 
-    if (line.empty()) {  // Skip empty lines for reference, store for target
-      if (is_target) {
-        line_breaks.push_back(sequence.size());
-      }
+    // Skip empty lines for reference, keep them as lines of length 0 for
+    // target
+    if (line.empty() && !is_target) {
       continue;
     }
 
@@ -152,7 +859,10 @@ void load_sequence(const string& filename, vector<char>& sequence,
           }
         }
         sequence.push_back(c);
-        sequence_encoded.push_back(base_to_index[toupper(c)]);
+        // Target is encoded from its cleaned sequence once masks are known
+        if (!is_target) {
+          sequence_encoded.push_back(base_to_index[(unsigned char)c]);
+        }
         length++;
       }
     }
@@ -173,351 +883,1748 @@ void load_sequence(const string& filename, vector<char>& sequence,
   file.close();
 }
 
-void build_hash_table() {
+inline void hash_kmer(uint64_t kmer, int table_bits, uint64_t& bucket,
+                      uint16_t& tag) {
   /**
-   * Build hash table of k-mers from the reference sequence using rolling hash
-   * @author Lorena Švenjak, Polina Rykova
+   * Split the k-mer hash into a home bucket and a 16 bit fingerprint
+   * taken from the bits right below the bucket index
    */
-  if (ref_seq_encoded.size() < KMER_LENGTH) {
-    throw runtime_error("Reference sequence too short for k-mer size");
+  uint64_t h = kmer * KMER_HASH_MULTIPLIER;
+  bucket = h >> (64 - table_bits);
+  tag = (uint16_t)(h >> (48 - table_bits));
+  if (tag == 0) {
+    tag = 1;
+  }
+}
+
+template <int K>
+constexpr uint64_t kmer_mask() {
+  /**
+   * Mask of the 2K bits holding a packed k-mer
+   */
+  return K == 32 ? ~0ULL : (1ULL << (2 * K)) - 1;
+}
+
+template <typename Pos>
+inline unsigned bucket_tag_mask(const KmerBucket<Pos>& bucket, uint16_t tag) {
+  /**
+   * Compare all tags of a bucket at once, bit i is set when slot i matches
+   * Passing tag 0 gives the mask of empty slots
+   */
+#ifdef __SSE2__
+  __m128i tags = _mm_load_si128((const __m128i*)bucket.tags);
+  unsigned bytes =
+      _mm_movemask_epi8(_mm_cmpeq_epi16(tags, _mm_set1_epi16(tag)));
+  // Keep one bit per 16 bit lane
+  bytes &= 0x5555;
+  bytes = (bytes | (bytes >> 1)) & 0x3333;
+  bytes = (bytes | (bytes >> 2)) & 0x0F0F;
+  bytes = (bytes | (bytes >> 4)) & 0x00FF;
+  return bytes;
+#else
+  unsigned mask = 0;
+  for (int i = 0; i < BUCKET_SLOTS; ++i) {
+    mask |= (unsigned)(bucket.tags[i] == tag) << i;
   }
+  return mask;
+#endif
+}
 
-  loc.resize(ref_seq_encoded.size(), -1);
+template <int K, typename Pos>
+void build_tagged_table() {
+  /**
+   * Build the tagged k-mer table from the reference using rolling hash
+   * Open addressing over cache line sized buckets, a full bucket spills into
+   * the next one so all positions of a k-mer stay in consecutive buckets
+   * A probe sequence is at most MAX_BUCKET_PROBES buckets long, positions
+   * that find no free slot in it are dropped, so k-mers of long repeats
+   * cannot turn the build and the lookups quadratic
+   * @author Lorena Švenjak, Polina Rykova
+   */
+  HugeVector<KmerBucket<Pos>>& kmer_table = reference_index<Pos>().kmer_table;
+  int64_t kmer_count = ref_seq_encoded.size() - K + 1;
+  int64_t entry_count = (kmer_count + options.index_step - 1) /
+                        options.index_step;
+  kmer_table_bits = 1;
+  while ((1ULL << kmer_table_bits) * BUCKET_FILL < (uint64_t)entry_count) {
+    kmer_table_bits++;
+  }
+  kmer_table_mask = (1ULL << kmer_table_bits) - 1;
+  kmer_table.assign(1ULL << kmer_table_bits, KmerBucket<Pos>());
 
-  // Compute the hash of the first k-mer
+  const uint64_t mask = kmer_mask<K>();
   uint64_t value = 0;
-  for (int k = 0; k < KMER_LENGTH; ++k) {
+  for (int k = 0; k < K - 1; ++k) {
     value <<= 2;
     value += ref_seq_encoded[k];
   }
 
-  int idx = value & (HASH_TABLE_SIZE - 1);
-  loc[0] = point[idx];
-  point[idx] = 0;
-
-  const uint64_t mask = (1ULL << (2 * KMER_LENGTH)) - 1;
-
   // Use rolling hash to compute for next k-mers
-  for (int i = 1; i <= ref_seq_encoded.size() - KMER_LENGTH; ++i) {
+  int64_t next_indexed = 0;
+  for (int64_t i = 0; i < kmer_count; ++i) {
     value <<= 2;
-    value += (ref_seq_encoded[i + KMER_LENGTH - 1]);
+    value += ref_seq_encoded[i + K - 1];
     value &= mask;
+    if (i != next_indexed) {
+      continue;
+    }
+    next_indexed += options.index_step;
+
+    uint64_t idx;
+    uint16_t tag;
+    hash_kmer(value, kmer_table_bits, idx, tag);
+
+    unsigned empty = bucket_tag_mask(kmer_table[idx], 0);
+    for (int probe = 1; !empty && probe < MAX_BUCKET_PROBES; ++probe) {
+      idx = (idx + 1) & kmer_table_mask;
+      empty = bucket_tag_mask(kmer_table[idx], 0);
+    }
+    if (!empty) {
+      continue;
+    }
 
-    idx = value & (HASH_TABLE_SIZE - 1);
-    loc[i] = point[idx];
-    point[idx] = i;
+    int slot = __builtin_ctz(empty);
+    kmer_table[idx].tags[slot] = tag;
+    kmer_table[idx].positions[slot] = i;
   }
 }
 
-void process_target_sequence() {
+template <typename Pos, typename Generator>
+void fill_csr_table(int64_t entry_count, Generator for_each_entry) {
   /**
-   * Processes the target genome sequence to identify special features :
-   * - lowercase regions
-   * - n regions (unknown bases)
-   * - other special characters
-   * @author Lorena Švenjak, Polina Rykova
+   * Counting sort of (k-mer, position) entries into the CSR index
+   * for_each_entry calls its argument with every entry in position order,
+   * so each bucket is a contiguous run of tags and increasing positions
    */
-  bool in_lowercase = false;
-  bool in_n_region = false;
-  int lowercase_start = 0;
-  int n_start = 0;
-  bool valid;
+  ReferenceIndex<Pos>& index = reference_index<Pos>();
+  HugeVector<Pos>& csr_offsets = index.csr_offsets;
+  HugeVector<uint16_t>& csr_tags = index.csr_tags;
+  HugeVector<Pos>& csr_positions = index.csr_positions;
+
+  kmer_table_bits = 1;
+  while ((1ULL << kmer_table_bits) * CSR_BUCKET_FILL < (uint64_t)entry_count) {
+    kmer_table_bits++;
+  }
+  kmer_table_mask = (1ULL << kmer_table_bits) - 1;
+
+  csr_offsets.assign((1ULL << kmer_table_bits) + 1, 0);
+  csr_tags.resize(entry_count);
+  csr_positions.resize(entry_count);
+
+  // First pass counts bucket sizes
+  for_each_entry([&](uint64_t kmer, int64_t) {
+    uint64_t idx;
+    uint16_t tag;
+    hash_kmer(kmer, kmer_table_bits, idx, tag);
+    csr_offsets[idx + 1]++;
+  });
+
+  // Exclusive prefix sum, offsets[idx] is the next free slot of bucket
+  for (size_t b = 1; b < csr_offsets.size(); ++b) {
+    csr_offsets[b] += csr_offsets[b - 1];
+  }
 
-  for (int i = 0; i < target_seq.size(); ++i) {
-    char c = target_seq[i];
-    valid = true;
+  // Second pass places the positions
+  for_each_entry([&](uint64_t kmer, int64_t position) {
+    uint64_t idx;
+    uint16_t tag;
+    hash_kmer(kmer, kmer_table_bits, idx, tag);
+    Pos slot = csr_offsets[idx]++;
+    csr_tags[slot] = tag;
+    csr_positions[slot] = position;
+  });
+
+  // Filling advanced every offset to the start of the following bucket
+  for (size_t b = csr_offsets.size() - 1; b > 0; --b) {
+    csr_offsets[b] = csr_offsets[b - 1];
+  }
+  csr_offsets[0] = 0;
+}
 
-    if (islower(c)) {
-      if (!in_lowercase) {
-        lowercase_start = i;
-        in_lowercase = true;
-      }
-      valid = true;
-    } else if (in_lowercase) {
-      lowercase_ranges.push_back({lowercase_start, i - lowercase_start});
-      in_lowercase = false;
+template <int K, typename Pos>
+void build_csr_table() {
+  /**
+   * Build the CSR k-mer index of every index_step-th reference position
+   * using rolling hash
+   */
+  int64_t kmer_count = ref_seq_encoded.size() - K + 1;
+  int64_t step = options.index_step;
+  const uint64_t mask = kmer_mask<K>();
+
+  int64_t entry_count = (kmer_count + step - 1) / step;
+  fill_csr_table<Pos>(entry_count, [&](function<void(uint64_t, int64_t)> add) {
+    uint64_t value = 0;
+    for (int k = 0; k < K - 1; ++k) {
+      value <<= 2;
+      value += ref_seq_encoded[k];
     }
 
-    if (c == 'N') {
-      if (!in_n_region) {
-        n_start = i;
-        in_n_region = true;
+    for (int64_t i = 0; i < kmer_count; ++i) {
+      value <<= 2;
+      value += ref_seq_encoded[i + K - 1];
+      value &= mask;
+      if (i % step == 0) {
+        add(value, i);
       }
-      valid = true;
-    } else if (in_n_region) {
-      n_ranges.push_back({n_start, i - n_start});
-      in_n_region = false;
     }
+  });
+}
 
-    // Chack if the char is a base or special
-    switch (toupper(c)) {
-      case 'A':
-      case 'C':
-      case 'G':
-      case 'T':
-        valid = true;
-        break;
-      default:
-        special_chars.push_back({i, c});
-        valid = false;
+template <int K>
+void compute_minimizers(const HugeVector<int>& sequence, int window,
+                        vector<Minimizer>& minimizers) {
+  /**
+   * Collect the (w,k) minimizers of a sequence, the canonical k-mer with the
+   * smallest hash in every window of w consecutive k-mers
+   * Equal k-mers in target and reference, on either strand, are selected
+   * the same way, so a shared segment shares its minimizers
+   */
+  int64_t kmer_count = (int64_t)sequence.size() - K + 1;
+  if (kmer_count <= 0) {
+    return;
+  }
+
+  // Ring buffers over the last window k-mers, a monotone queue of window
+  // minimum candidates in which the rightmost minimum wins
+  // The queue briefly holds window + 1 entries before the oldest expires,
+  // so the ring is larger than the window
+  const uint64_t mask = kmer_mask<K>();
+  int ring_size = 1;
+  while (ring_size <= window) {
+    ring_size <<= 1;
+  }
+  const int ring_mask = ring_size - 1;
+  vector<Minimizer> kmers(ring_size);
+  vector<uint64_t> order(ring_size);
+  vector<int64_t> queue(ring_size);
+  int head = 0, queue_size = 0;
+  int64_t last_selected = -1;
+
+  uint64_t value = 0;
+  uint64_t rc_value = 0;
+  for (int64_t i = 0; i < (int64_t)sequence.size(); ++i) {
+    value = ((value << 2) + sequence[i]) & mask;
+    rc_value = (rc_value >> 2) +
+               ((uint64_t)(3 - sequence[i]) << (2 * (K - 1)));
+
+    int64_t start = i - K + 1;
+    if (start < 0) {
+      continue;
     }
 
-    // Store bases into cleaned sequence
-    if (valid) {
-      target_seq_cleaned.push_back(toupper(c));
+    int slot = start & ring_mask;
+    bool reverse = rc_value < value;
+    kmers[slot] = {start, reverse, reverse ? rc_value : value};
+    order[slot] = kmers[slot].kmer * KMER_HASH_MULTIPLIER;
+
+    while (queue_size > 0 &&
+           order[queue[(head + queue_size - 1) & ring_mask] & ring_mask] >=
+               order[slot]) {
+      queue_size--;
+    }
+    queue[(head + queue_size) & ring_mask] = start;
+    queue_size++;
+    if (queue[head] <= start - window) {
+      head = (head + 1) & ring_mask;
+      queue_size--;
     }
 
-    // Close any open ranges
-    if (i == target_seq.size() - 1) {
-      if (in_lowercase) {
-        lowercase_ranges.push_back({lowercase_start, i + 1 - lowercase_start});
-        in_lowercase = false;
-      }
-      if (in_n_region) {
-        n_ranges.push_back({n_start, i - n_start});
-        in_n_region = false;
+    if (start >= window - 1 || start == kmer_count - 1) {
+      int64_t selected = queue[head];
+      if (selected != last_selected) {
+        minimizers.push_back(kmers[selected & ring_mask]);
+        last_selected = selected;
       }
     }
   }
 }
 
-void encode_sequence(vector<char>& sequence, vector<int>& encoded_sequence) {
+template <int K, typename Pos>
+void build_minimizer_table() {
   /**
-   * Encode cleaned sequence into a numerical format for compression
-   * A=0, C=1, G=2, T=3
-   * @author Lorena Švenjak
+   * Build the CSR index over reference minimizers only, about 2/(w+1) of
+   * all positions, the strand is kept in the lowest position bit
    */
-  for (int i = 0; i < sequence.size(); ++i) {
-    char c = toupper(sequence[i]);
-    switch (c) {
-      case 'A':
-        encoded_sequence.push_back(0);
-        break;
-      case 'C':
-        encoded_sequence.push_back(1);
-        break;
-      case 'G':
-        encoded_sequence.push_back(2);
-        break;
-      case 'T':
-        encoded_sequence.push_back(3);
-        break;
-      default:
-        continue;
-    }
+  vector<Minimizer> minimizers;
+  compute_minimizers<K>(ref_seq_encoded, options.minimizer_window, minimizers);
+
+  fill_csr_table<Pos>(
+      minimizers.size(), [&](function<void(uint64_t, int64_t)> add) {
+        for (const Minimizer& m : minimizers) {
+          add(m.kmer, (m.pos << 1) | m.reverse);
+        }
+      });
+}
+
+uint64_t reference_checksum() {
+  /**
+   * FNV-1a checksum of the encoded reference, ties a saved index to the
+   * reference it was built from
+   */
+  uint64_t checksum = 0xcbf29ce484222325ULL;
+  for (int base : ref_seq_encoded) {
+    checksum ^= (uint64_t)base;
+    checksum *= 0x100000001b3ULL;
   }
+  return checksum;
 }
 
-void write_metadata(const string& output_filename) {
+template <typename Pos>
+void save_csr_table(const string& filename) {
   /**
-   * Write all auxiliary metadata needed for decompression as plain text
-   * @author Lorena Švenjak
+   * Write the CSR or minimizer index to disk so later runs against the
+   * same reference can skip building it
    */
-  ofstream out(output_filename);
+  const ReferenceIndex<Pos>& index = reference_index<Pos>();
+  ofstream out(filename, ios::binary);
   if (!out) {
-    throw runtime_error("Cannot open output file: " + output_filename);
+    throw runtime_error("Cannot open index file: " + filename);
+  }
+
+  uint32_t kmer_length = options.kmer_length;
+  uint32_t table_bits = kmer_table_bits;
+  uint64_t ref_length = ref_seq_encoded.size();
+  uint64_t checksum = reference_checksum();
+  uint64_t position_count = index.csr_positions.size();
+  uint32_t layout = options.index_layout;
+  uint32_t window = options.minimizer_window;
+  uint32_t position_bits = options.position_bits;
+  uint32_t index_step = options.index_step;
+
+  out.write(INDEX_FILE_MAGIC, sizeof(INDEX_FILE_MAGIC));
+  out.write((const char*)&INDEX_FILE_VERSION, sizeof(INDEX_FILE_VERSION));
+  out.write((const char*)&layout, sizeof(layout));
+  out.write((const char*)&window, sizeof(window));
+  out.write((const char*)&position_bits, sizeof(position_bits));
+  out.write((const char*)&kmer_length, sizeof(kmer_length));
+  out.write((const char*)&table_bits, sizeof(table_bits));
+  out.write((const char*)&index_step, sizeof(index_step));
+  out.write((const char*)&ref_length, sizeof(ref_length));
+  out.write((const char*)&checksum, sizeof(checksum));
+  out.write((const char*)&position_count, sizeof(position_count));
+  out.write((const char*)index.csr_offsets.data(),
+            index.csr_offsets.size() * sizeof(Pos));
+  out.write((const char*)index.csr_tags.data(),
+            position_count * sizeof(uint16_t));
+  out.write((const char*)index.csr_positions.data(),
+            position_count * sizeof(Pos));
+
+  if (!out) {
+    throw runtime_error("Failed writing index file: " + filename);
+  }
+}
+
+IndexLayout saved_index_layout(const string& filename) {
+  /**
+   * Layout recorded in an index file header, the configured layout when the
+   * header cannot be read, load_csr_table() reports that case
+   */
+  char magic[sizeof(INDEX_FILE_MAGIC)];
+  uint32_t version, layout;
+  ifstream in(filename, ios::binary);
+  in.read(magic, sizeof(magic));
+  in.read((char*)&version, sizeof(version));
+  in.read((char*)&layout, sizeof(layout));
+  if (!in || (layout != INDEX_CSR && layout != INDEX_MINIMIZER)) {
+    return options.index_layout;
+  }
+  return (IndexLayout)layout;
+}
+
+template <typename Pos>
+void load_csr_table(const string& filename) {
+  /**
+   * Read a CSR index written by save_csr_table()
+   * The index must match the k-mer length and the loaded reference
+   */
+  ReferenceIndex<Pos>& index = reference_index<Pos>();
+  ifstream in(filename, ios::binary);
+  if (!in) {
+    throw runtime_error("Cannot open index file: " + filename);
+  }
+
+  char magic[sizeof(INDEX_FILE_MAGIC)];
+  uint32_t version, layout, window, position_bits, kmer_length, table_bits,
+      index_step;
+  uint64_t ref_length, checksum, position_count;
+
+  in.read(magic, sizeof(magic));
+  in.read((char*)&version, sizeof(version));
+  in.read((char*)&layout, sizeof(layout));
+  in.read((char*)&window, sizeof(window));
+  in.read((char*)&position_bits, sizeof(position_bits));
+  in.read((char*)&kmer_length, sizeof(kmer_length));
+  in.read((char*)&table_bits, sizeof(table_bits));
+  in.read((char*)&index_step, sizeof(index_step));
+  in.read((char*)&ref_length, sizeof(ref_length));
+  in.read((char*)&checksum, sizeof(checksum));
+  in.read((char*)&position_count, sizeof(position_count));
+
+  if (!in || memcmp(magic, INDEX_FILE_MAGIC, sizeof(magic)) != 0 ||
+      version != INDEX_FILE_VERSION ||
+      (layout != INDEX_CSR && layout != INDEX_MINIMIZER)) {
+    throw runtime_error("Not a valid index file: " + filename);
+  }
+  if (kmer_length != (uint32_t)options.kmer_length ||
+      position_bits != (uint32_t)options.position_bits ||
+      ref_length != ref_seq_encoded.size() ||
+      checksum != reference_checksum() ||
+      position_count > ref_length - kmer_length + 1 || table_bits > 40 ||
+      index_step == 0) {
+    throw runtime_error("Index file does not match the reference: " +
+                        filename);
+  }
+  if (options.index_layout_set && layout != (uint32_t)options.index_layout) {
+    throw runtime_error("Index file was saved with another layout than -i: " +
+                        filename);
+  }
+
+  // The step is fixed when the index is built, the level only picks it
+  if (index_step != (uint32_t)options.index_step) {
+    report() << "Index file was built with index step " << index_step
+         << ", level asked for " << options.index_step << endl;
+  }
+
+  options.index_layout = (IndexLayout)layout;
+  options.minimizer_window = window;
+  options.index_step = index_step;
+  kmer_table_bits = table_bits;
+  kmer_table_mask = (1ULL << kmer_table_bits) - 1;
+  index.csr_offsets.resize((1ULL << kmer_table_bits) + 1);
+  index.csr_tags.resize(position_count);
+  index.csr_positions.resize(position_count);
+
+  in.read((char*)index.csr_offsets.data(),
+          index.csr_offsets.size() * sizeof(Pos));
+  in.read((char*)index.csr_tags.data(), position_count * sizeof(uint16_t));
+  in.read((char*)index.csr_positions.data(), position_count * sizeof(Pos));
+
+  if (!in) {
+    throw runtime_error("Truncated index file: " + filename);
+  }
+
+  // Offsets and positions are used as indexes, so a corrupt file must not
+  // point outside of the positions or the reference
+  const HugeVector<Pos>& offsets = index.csr_offsets;
+  if (offsets[0] != 0 || (uint64_t)offsets.back() != position_count ||
+      !is_sorted(offsets.begin(), offsets.end())) {
+    throw runtime_error("Corrupt index file: " + filename);
+  }
+  int strand_bits = layout == INDEX_MINIMIZER ? 1 : 0;
+  for (Pos position : index.csr_positions) {
+    if (position < 0 ||
+        (uint64_t)(position >> strand_bits) > ref_length - kmer_length) {
+      throw runtime_error("Corrupt index file: " + filename);
+    }
+  }
+}
+
+template <typename Symbol, typename Index>
+void suffix_array_is(const Symbol* text, Index* sa, Index n, Index alphabet) {
+  /**
+   * SA-IS suffix array construction (Nong, Zhang, Chan) in linear time
+   * text[n - 1] must be the unique smallest symbol, symbols are in
+   * 0..alphabet, the reduced problem is stored in the tail of sa
+   * Bytes at the top level keep the text cache resident, names of the
+   * reduced problems need the full Index width
+   */
+  vector<uint8_t> s_type(n);
+  s_type[n - 1] = true;
+  for (Index i = n - 2; i >= 0; --i) {
+    s_type[i] = text[i] < text[i + 1] ||
+                (text[i] == text[i + 1] && s_type[i + 1]);
+  }
+  auto is_lms = [&](Index i) { return i > 0 && s_type[i] && !s_type[i - 1]; };
+
+  vector<Index> bucket(alphabet + 1);
+  auto get_buckets = [&](bool ends) {
+    fill(bucket.begin(), bucket.end(), 0);
+    for (Index i = 0; i < n; ++i) {
+      bucket[text[i]]++;
+    }
+    Index sum = 0;
+    for (Index c = 0; c <= alphabet; ++c) {
+      sum += bucket[c];
+      bucket[c] = ends ? sum : sum - bucket[c];
+    }
+  };
+  auto induce = [&]() {
+    get_buckets(false);
+    for (Index i = 0; i < n; ++i) {
+      Index j = sa[i] - 1;
+      if (sa[i] > 0 && !s_type[j]) {
+        sa[bucket[text[j]]++] = j;
+      }
+    }
+    get_buckets(true);
+    for (Index i = n - 1; i >= 0; --i) {
+      Index j = sa[i] - 1;
+      if (sa[i] > 0 && s_type[j]) {
+        sa[--bucket[text[j]]] = j;
+      }
+    }
+  };
+
+  // Sort LMS substrings by inducing from their bucket ends
+  get_buckets(true);
+  fill(sa, sa + n, -1);
+  for (Index i = 1; i < n; ++i) {
+    if (is_lms(i)) {
+      sa[--bucket[text[i]]] = i;
+    }
+  }
+  induce();
+
+  // Name the sorted LMS substrings
+  Index lms_count = 0;
+  for (Index i = 0; i < n; ++i) {
+    if (is_lms(sa[i])) {
+      sa[lms_count++] = sa[i];
+    }
+  }
+  fill(sa + lms_count, sa + n, -1);
+  Index name = 0, prev = -1;
+  for (Index i = 0; i < lms_count; ++i) {
+    Index pos = sa[i];
+    bool differs = false;
+    for (Index d = 0; d < n; ++d) {
+      if (prev == -1 || text[pos + d] != text[prev + d] ||
+          s_type[pos + d] != s_type[prev + d]) {
+        differs = true;
+        break;
+      } else if (d > 0 && (is_lms(pos + d) || is_lms(prev + d))) {
+        break;
+      }
+    }
+    if (differs) {
+      name++;
+      prev = pos;
+    }
+    sa[lms_count + pos / 2] = name - 1;
+  }
+  for (Index i = n - 1, j = n - 1; i >= lms_count; --i) {
+    if (sa[i] >= 0) {
+      sa[j--] = sa[i];
+    }
+  }
+
+  // Sort the LMS suffixes, recursing while names are not unique
+  Index* reduced = sa + n - lms_count;
+  if (name < lms_count) {
+    suffix_array_is(reduced, sa, lms_count, name - 1);
+  } else {
+    for (Index i = 0; i < lms_count; ++i) {
+      sa[reduced[i]] = i;
+    }
+  }
+
+  // Induce the full suffix array from the sorted LMS suffixes
+  get_buckets(true);
+  for (Index i = 1, j = 0; i < n; ++i) {
+    if (is_lms(i)) {
+      reduced[j++] = i;
+    }
+  }
+  for (Index i = 0; i < lms_count; ++i) {
+    sa[i] = reduced[sa[i]];
+  }
+  fill(sa + lms_count, sa + n, -1);
+  for (Index i = lms_count - 1; i >= 0; --i) {
+    Index j = sa[i];
+    sa[i] = -1;
+    sa[--bucket[text[j]]] = j;
+  }
+  induce();
+}
+
+template <typename Pos>
+inline Pos fm_rank(int base, Pos i) {
+  /**
+   * Number of occurrences of base in the BWT before position i
+   */
+  const FmBlock<Pos>& block =
+      reference_index<Pos>().fm_blocks[i / OCC_SAMPLE_RATE];
+  uint64_t below = (1ULL << (i % OCC_SAMPLE_RATE)) - 1;
+  return block.counts[base] + __builtin_popcountll(block.masks[base] & below);
+}
+
+template <typename Pos>
+inline bool fm_extend(int base, Pos& lo, Pos& hi) {
+  /**
+   * One backward search step, narrows the interval to the suffixes
+   * extended by base, returns false when none is left
+   */
+  Pos next_lo = fm_count[base + 2] + fm_rank(base, lo);
+  Pos next_hi = fm_count[base + 2] + fm_rank(base, hi);
+  if (next_lo >= next_hi) {
+    return false;
+  }
+  lo = next_lo;
+  hi = next_hi;
+  return true;
+}
+
+template <typename Pos>
+void build_fm_prefix_intervals() {
+  /**
+   * Precompute the suffix array interval of every FM_PREFIX_LENGTH-mer,
+   * each one from the interval of its prefix, so a lookup starts after
+   * the first FM_PREFIX_LENGTH bases
+   */
+  ReferenceIndex<Pos>& index = reference_index<Pos>();
+
+  // Intervals by depth, children of an empty interval stay empty
+  HugeVector<Pos> level = {0, index.fm_size};
+  for (int depth = 1; depth <= FM_PREFIX_LENGTH; ++depth) {
+    HugeVector<Pos> next(level.size() * 4, 0);
+    for (size_t prefix = 0; prefix < level.size() / 2; ++prefix) {
+      for (int base = 0; base < 4; ++base) {
+        Pos lo = level[2 * prefix], hi = level[2 * prefix + 1];
+        size_t child = prefix * 4 + base;
+        if (lo < hi && fm_extend(base, lo, hi)) {
+          next[2 * child] = lo;
+          next[2 * child + 1] = hi;
+        }
+      }
+    }
+    level.swap(next);
+  }
+  index.fm_prefix_intervals.swap(level);
+}
+
+template <typename Pos>
+void build_fm_index() {
+  /**
+   * Build the FM-index of reverse(reference + separator + reverse
+   * complement), backward search on it extends a target match forwards,
+   * one base at a time, on both strands at once
+   */
+  ReferenceIndex<Pos>& index = reference_index<Pos>();
+  Pos n = ref_seq_encoded.size();
+  Pos m = 2 * n + 2;
+
+  // text[j] is base 2n - j of reference + separator + reverse complement
+  vector<uint8_t> text(m);
+  for (Pos i = 0; i < n; ++i) {
+    text[i] = 2 + 3 - ref_seq_encoded[i];
+    text[n + 1 + i] = 2 + ref_seq_encoded[n - 1 - i];
+  }
+  text[n] = 1;
+  text[m - 1] = 0;
+
+  index.fm_suffix_array.resize(m);
+  suffix_array_is(text.data(), index.fm_suffix_array.data(), m, (Pos)5);
+
+  index.fm_size = m;
+  index.fm_blocks.assign(m / OCC_SAMPLE_RATE + 1, FmBlock<Pos>());
+  memset(fm_count, 0, sizeof(fm_count));
+
+  Pos counts[6] = {0};
+  for (Pos i = 0; i < m; ++i) {
+    FmBlock<Pos>& block = index.fm_blocks[i / OCC_SAMPLE_RATE];
+    if (i % OCC_SAMPLE_RATE == 0) {
+      for (int b = 0; b < 4; ++b) {
+        block.counts[b] = counts[b + 2];
+      }
+    }
+    Pos p = index.fm_suffix_array[i];
+    int symbol = text[p == 0 ? m - 1 : p - 1];
+    if (symbol >= 2) {
+      block.masks[symbol - 2] |= 1ULL << (i % OCC_SAMPLE_RATE);
+    }
+    counts[symbol]++;
+  }
+  for (int c = 1; c < 7; ++c) {
+    fm_count[c] = fm_count[c - 1] + counts[c - 1];
+  }
+
+  build_fm_prefix_intervals<Pos>();
+}
+
+template <typename Pos>
+void find_fm_match(int64_t tar_pos, int64_t& match_ref_pos,
+                   int64_t& match_length, bool& match_reverse) {
+  /**
+   * Longest match at tar_pos on either strand by backward search, each
+   * target base narrows the suffix array interval with two rank queries,
+   * independent of how many copies of the match the reference holds
+   */
+  const ReferenceIndex<Pos>& index = reference_index<Pos>();
+  int64_t n = ref_seq_encoded.size();
+  int64_t tar_size = target_seq_encoded.size();
+
+  match_length = 0;
+  match_reverse = false;
+  match_ref_pos = -1;
+  if (MATCHER_COUNTERS) {
+    matcher_counters.hash_lookups++;
+  }
+
+  // Callers guarantee a full k-mer, so the prefix table always applies
+  size_t prefix = 0;
+  for (int i = 0; i < FM_PREFIX_LENGTH; ++i) {
+    prefix = (prefix << 2) + target_seq_encoded[tar_pos + i];
+  }
+  Pos lo = index.fm_prefix_intervals[2 * prefix];
+  Pos hi = index.fm_prefix_intervals[2 * prefix + 1];
+  if (lo >= hi) {
+    return;
+  }
+
+  int64_t length = FM_PREFIX_LENGTH;
+  while (tar_pos + length < tar_size &&
+         fm_extend(target_seq_encoded[tar_pos + length], lo, hi)) {
+    length++;
+  }
+  match_length = length;
+
+  // Map the match back onto reference + separator + reverse complement
+  int64_t start = 2 * n + 1 - index.fm_suffix_array[lo] - length;
+  if (start < n) {
+    match_ref_pos = start;
+  } else {
+    match_ref_pos = 2 * n - start;
+    match_reverse = true;
+  }
+}
+
+template <int K, typename Pos>
+void build_hash_table(const InputFileNames& input_file_names) {
+  /**
+   * Build or load the k-mer index of the reference in the selected layout
+   * @author Lorena Švenjak, Polina Rykova
+   */
+  PhaseTimer phase(PHASE_INDEX);
+  if (ref_seq_encoded.size() < K) {
+    throw runtime_error("Reference sequence too short for k-mer size");
   }
 
-  // Write header
-  out << header << "\n\n";
+  if (!input_file_names.index_load_file.empty()) {
+    load_csr_table<Pos>(input_file_names.index_load_file);
+  } else if (options.index_layout == INDEX_CSR) {
+    build_csr_table<K, Pos>();
+  } else if (options.index_layout == INDEX_MINIMIZER) {
+    build_minimizer_table<K, Pos>();
+  } else if (options.index_layout == INDEX_FM) {
+    build_fm_index<Pos>();
+  } else {
+    build_tagged_table<K, Pos>();
+  }
+
+  if (!input_file_names.index_save_file.empty()) {
+    save_csr_table<Pos>(input_file_names.index_save_file);
+  }
+
+  const ReferenceIndex<Pos>& index = reference_index<Pos>();
+  size_t index_bytes = index.kmer_table.size() * sizeof(KmerBucket<Pos>) +
+                       index.csr_offsets.size() * sizeof(Pos) +
+                       index.csr_tags.size() * sizeof(uint16_t) +
+                       index.csr_positions.size() * sizeof(Pos) +
+                       index.fm_suffix_array.size() * sizeof(Pos) +
+                       index.fm_blocks.size() * sizeof(FmBlock<Pos>) +
+                       index.fm_prefix_intervals.size() * sizeof(Pos);
+  report() << "Index memory: " << index_bytes / 1024 << " kB, "
+       << options.position_bits << " bit positions" << endl;
+}
+
+void process_target_sequence() {
+  /**
+   * Processes the target genome sequence to identify special features :
+   * - lowercase regions
+   * - n regions (unknown bases)
+   * - other special characters
+   * Only the remaining bases are kept in the encoded sequence,
+   * so the matcher never has to step over N runs or special characters
+   * @author Lorena Švenjak, Polina Rykova
+   */
+  bool in_lowercase = false;
+  bool in_n_region = false;
+  int64_t lowercase_start = 0;
+  int64_t n_start = 0;
+
+  target_seq_encoded.reserve(target_seq.size());
+
+  for (int64_t i = 0; i < (int64_t)target_seq.size(); ++i) {
+    char c = target_seq[i];
+    char upper = toupper(c);
+
+    if (islower(c)) {
+      if (!in_lowercase) {
+        lowercase_start = i;
+        in_lowercase = true;
+      }
+    } else if (in_lowercase) {
+      lowercase_ranges.push_back({lowercase_start, i - lowercase_start});
+      in_lowercase = false;
+    }
+
+    if (upper == 'N') {
+      if (!in_n_region) {
+        n_start = i;
+        in_n_region = true;
+      }
+    } else if (in_n_region) {
+      n_ranges.push_back({n_start, i - n_start});
+      in_n_region = false;
+    }
+
+    // Chack if the char is a base or special, N is covered by its range
+    switch (upper) {
+      case 'A':
+      case 'C':
+      case 'G':
+      case 'T':
+        // Store bases into the encoded sequence
+        target_seq_encoded.push_back(base_to_index[(unsigned char)upper]);
+        break;
+      case 'N':
+        break;
+      default:
+        special_chars.push_back({i, c});
+    }
+  }
+
+  // Close any open ranges
+  if (in_lowercase) {
+    lowercase_ranges.push_back(
+        {lowercase_start, (int64_t)target_seq.size() - lowercase_start});
+  }
+  if (in_n_region) {
+    n_ranges.push_back({n_start, (int64_t)target_seq.size() - n_start});
+  }
+}
+
+void put_varint(string& out, uint64_t value) {
+  /**
+   * Append value as LEB128
+   */
+  while (value >= 0x80) {
+    out.push_back((char)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((char)value);
+}
+
+void put_value(StreamBlock& block, uint64_t value) {
+  /**
+   * Append one value to a stream block with the codec of its stream
+   */
+  switch (STREAM_CODECS[block.id]) {
+    case CODEC_RAW:
+      block.bytes.push_back((char)value);
+      break;
+    case CODEC_ZIGZAG_VARINT:
+      value = (value << 1) ^ (uint64_t)((int64_t)value >> 63);
+      // fall through
+    case CODEC_VARINT:
+      put_varint(block.bytes, value);
+      break;
+    case CODEC_PACKED_2BIT:
+      if (block.count % 4 == 0) {
+        block.bytes.push_back(0);
+      }
+      block.bytes.back() |= (char)(value << (2 * (block.count % 4)));
+      break;
+  }
+  block.count++;
+}
+
+void encode_metadata(StreamBlock* streams) {
+  /**
+   * Code the header, line layout and masks of the target into their
+   * streams, ranges are stored as the gap after the previous range
+   * @author Lorena Švenjak
+   */
+  for (char c : header) {
+    put_value(streams[STREAM_HEADER], (uint8_t)c);
+  }
 
-  // Write line lengths
-  out << line_lengths.size() * 2;
   for (const auto& line_length : line_lengths) {
-    out << " " << line_length.length << " " << line_length.repeat_count;
+    put_value(streams[STREAM_LINE_LENGTHS], line_length.length);
+    put_value(streams[STREAM_LINE_LENGTHS], line_length.repeat_count);
   }
-  out << "\n";
 
-  // Lowercase ranges
-  int last_position = 0;
-  out << lowercase_ranges.size();
+  int64_t last_position = 0;
   for (const auto& r : lowercase_ranges) {
-    out << " " << r.start - last_position << " " << r.length;
+    put_value(streams[STREAM_LOWERCASE_RANGES], r.start - last_position);
+    put_value(streams[STREAM_LOWERCASE_RANGES], r.length);
     last_position = r.start + r.length;
   }
-  out << "\n";
 
-  // N ranges
   last_position = 0;
-  out << n_ranges.size();
   for (const auto& r : n_ranges) {
-    out << " " << r.start - last_position << " " << r.length;
+    put_value(streams[STREAM_N_RANGES], r.start - last_position);
+    put_value(streams[STREAM_N_RANGES], r.length);
     last_position = r.start + r.length;
   }
-  out << "\n";
 
-  // Special characters
-  set<char> seen;
-  vector<char> unique_chars;
   last_position = 0;
-
-  out << special_chars.size();
   for (const auto& sc : special_chars) {
-    out << " " << sc.pos - last_position;
+    put_value(streams[STREAM_SPECIAL_GAPS], sc.pos - last_position);
+    put_value(streams[STREAM_SPECIAL_CHARS], (uint8_t)sc.ch);
     last_position = sc.pos + 1;
+  }
+}
 
-    // Collect unique characters
-    if (seen.insert(sc.ch).second) {
-      unique_chars.push_back(sc.ch);
+int64_t extend_match(int64_t ref_pos, int64_t tar_pos, bool reverse) {
+  /**
+   * Count matching bases from ref_pos and tar_pos onwards
+   * A reverse match walks the reference backwards comparing complements
+   */
+  int64_t tar_size = target_seq_encoded.size();
+  int64_t length = 0;
+
+  if (reverse) {
+    int64_t max_possible = min(ref_pos + 1, tar_size - tar_pos);
+    while (length < max_possible &&
+           3 - ref_seq_encoded[ref_pos - length] ==
+               target_seq_encoded[tar_pos + length]) {
+      length++;
+    }
+  } else {
+    int64_t max_possible =
+        min((int64_t)ref_seq_encoded.size() - ref_pos, tar_size - tar_pos);
+    while (length < max_possible &&
+           ref_seq_encoded[ref_pos + length] ==
+               target_seq_encoded[tar_pos + length]) {
+      length++;
     }
   }
 
-  if (unique_chars.size()) {
-    out << " " << unique_chars.size() << " ";
+  if (MATCHER_COUNTERS) {
+    matcher_counters.bases_compared += length + 1;
   }
+  return length;
+}
 
-  // Distances from 'A'
-  for (char ch : unique_chars) {
-    out << toupper(ch) - 'A' << " ";
+template <typename Pos, typename Visitor>
+inline void for_each_candidate(uint64_t idx, uint16_t tag, Visitor visit) {
+  /**
+   * Call visit with every reference position in the probe sequence of
+   * bucket idx whose k-mer tag matches
+   * Positions can still be false positives and have to be verified
+   * At most options.max_candidates positions are visited when it is set
+   */
+  const ReferenceIndex<Pos>& index = reference_index<Pos>();
+  int remaining = options.max_candidates > 0 ? options.max_candidates : -1;
+  if (options.index_layout != INDEX_TAGGED) {
+    // Candidates of a bucket are one sequential run
+    Pos end = index.csr_offsets[idx + 1];
+    for (Pos i = index.csr_offsets[idx]; i < end && remaining != 0; ++i) {
+      if (index.csr_tags[i] == tag) {
+        visit(index.csr_positions[i]);
+        remaining--;
+      } else if (MATCHER_COUNTERS) {
+        matcher_counters.tag_rejected++;
+      }
+    }
+    return;
   }
 
-  // Unique chars pattern
-  for (const auto& sc : special_chars) {
-    auto it = find(unique_chars.begin(), unique_chars.end(), sc.ch);
-    out << distance(unique_chars.begin(), it);
+  for (int probe = 0; probe < MAX_BUCKET_PROBES; ++probe) {
+    const KmerBucket<Pos>& bucket = index.kmer_table[idx];
+    unsigned hits = bucket_tag_mask(bucket, tag);
+    if (MATCHER_COUNTERS) {
+      unsigned empty = bucket_tag_mask(bucket, 0);
+      matcher_counters.tag_rejected +=
+          BUCKET_SLOTS - __builtin_popcount(empty) - __builtin_popcount(hits);
+    }
+
+    while (hits) {
+      if (remaining-- == 0) {
+        return;
+      }
+      int slot = __builtin_ctz(hits);
+      hits &= hits - 1;
+      visit(bucket.positions[slot]);
+    }
+
+    // A bucket with a free slot ends the probe sequence, as does the
+    // probe limit of build_tagged_table()
+    if (bucket_tag_mask(bucket, 0)) {
+      break;
+    }
+    idx = (idx + 1) & kmer_table_mask;
   }
+}
 
-  out << "\n";
+template <int K, typename Pos>
+void resolve_longest_match(int64_t tar_pos, const uint64_t* buckets,
+                           const uint16_t* tags, Match& match) {
+  /**
+   * Verify and extend all candidates of the forward and reverse complement
+   * k-mer at tar_pos, keeping the longest match
+   */
+  match.ref_pos = -1;
+  match.tar_pos = tar_pos;
+  match.length = 0;
+  match.reverse = false;
+  uint64_t walked = 0;
+
+  // Forward strand candidates, then reverse complement candidates whose
+  // reference k-mer ends where the target k-mer starts
+  for (int strand = 0; strand < 2; ++strand) {
+    bool reverse = strand == 1;
+    for_each_candidate<Pos>(buckets[strand], tags[strand], [&](int64_t k) {
+      int64_t start = reverse ? k + K - 1 : k;
+      int64_t current_length = extend_match(start, tar_pos, reverse);
+      walked++;
+      if (MATCHER_COUNTERS && current_length < K) {
+        matcher_counters.verify_rejected++;
+      }
 
-  out.close();
+      if (current_length >= K && current_length > match.length) {
+        match.length = current_length;
+        match.ref_pos = start;
+        match.reverse = reverse;
+      }
+    });
+  }
+
+  if (MATCHER_COUNTERS) {
+    matcher_counters.hash_lookups++;
+    matcher_counters.candidates_walked += walked;
+    matcher_counters.chain_lengths.add(walked);
+  }
 }
 
-void find_longest_match(int tar_pos, int& match_ref_pos, int& match_length) {
+template <int K, typename Pos>
+void find_longest_match(int64_t tar_pos, int64_t& match_ref_pos,
+                        int64_t& match_length, bool& match_reverse) {
   /**
    * Finds the longest match between target and reference starting at tar_pos
-   * Uses the k-mer hash table to find candidate positions
+   * Uses the k-mer hash table to find candidate positions on both strands,
+   * the reverse complement k-mer is looked up in the same forward index
+   * Candidates are filtered by tag before any reference base is read
    * @author Lorena Švenjak
    */
   match_ref_pos = -1;
   match_length = 0;
+  match_reverse = false;
 
-  if (tar_pos + KMER_LENGTH > target_seq_encoded.size()) {
+  if (tar_pos + K > (int64_t)target_seq_encoded.size()) {
+    return;
+  }
+
+  if (options.index_layout == INDEX_FM) {
+    find_fm_match<Pos>(tar_pos, match_ref_pos, match_length, match_reverse);
     return;
   }
 
   uint64_t hash = 0;
-  for (int i = 0; i < KMER_LENGTH; ++i) {
+  uint64_t rc_hash = 0;
+  for (int i = 0; i < K; ++i) {
     hash <<= 2;
     hash += target_seq_encoded[tar_pos + i];
+    rc_hash >>= 2;
+    rc_hash += (uint64_t)(3 - target_seq_encoded[tar_pos + i])
+               << (2 * (K - 1));
   }
 
-  // Compute the hash value for the current k-mer in the target sequence
-  int idx = hash & (HASH_TABLE_SIZE - 1);
+  uint64_t buckets[2];
+  uint16_t tags[2];
+  hash_kmer(hash, kmer_table_bits, buckets[0], tags[0]);
+  hash_kmer(rc_hash, kmer_table_bits, buckets[1], tags[1]);
+
+  Match match;
+  resolve_longest_match<K, Pos>(tar_pos, buckets, tags, match);
+  match_ref_pos = match.ref_pos;
+  match_length = match.length;
+  match_reverse = match.reverse;
+}
 
-  // Find the longest match
-  int ht_half_size = HASH_TABLE_BIT >> 1;  // hash from 20 lowest bits of k-mer
-  int missing_bases_count = KMER_LENGTH - ht_half_size;
-  for (int k = point[idx]; k != -1; k = loc[k]) {
-    int current_length = 0;
+template <int K, typename Pos>
+void prepare_lookups(int64_t tar_pos, LookupBatch& batch) {
+  /**
+   * Hash the k-mers of up to LOOKUP_BATCH target positions from tar_pos
+   * and prefetch their buckets, then their first candidates, so the DRAM
+   * latency of one position overlaps with the others
+   * Slots are resolved with resolve_longest_match() one at a time, so
+   * positions a match covers are never extended
+   */
+  const ReferenceIndex<Pos>& index = reference_index<Pos>();
+  int count = (int)min<int64_t>(
+      LOOKUP_BATCH, (int64_t)target_seq_encoded.size() - K + 1 - tar_pos);
+  batch.start = tar_pos;
+  batch.end = tar_pos + max(count, 0);
+  if (count <= 0) {
+    return;
+  }
 
-    while (current_length < missing_bases_count &&
-           ref_seq_encoded[current_length + k] ==
-               target_seq_encoded[tar_pos + current_length])
-      current_length++;
+  uint64_t (*buckets)[2] = batch.buckets;
+  uint16_t (*tags)[2] = batch.tags;
+  const uint64_t mask = kmer_mask<K>();
 
-    if (current_length == missing_bases_count) {  // match found
-      current_length = KMER_LENGTH;
-      int max_possible = min((int)ref_seq_encoded.size() - k,
-                             (int)target_seq_encoded.size() - tar_pos);
-      while (current_length < max_possible &&
-             ref_seq_encoded[k + current_length] ==
-                 target_seq_encoded[tar_pos + current_length]) {
-        current_length++;
+  // Rolling hashes of the window, prefetch the home buckets
+  uint64_t hash = 0;
+  uint64_t rc_hash = 0;
+  for (int i = 0; i < K - 1; ++i) {
+    hash = (hash << 2) + target_seq_encoded[tar_pos + i];
+    rc_hash = (rc_hash >> 2) + ((uint64_t)(3 - target_seq_encoded[tar_pos + i])
+                                << (2 * (K - 1)));
+  }
+  for (int b = 0; b < count; ++b) {
+    int base = target_seq_encoded[tar_pos + b + K - 1];
+    hash = ((hash << 2) + base) & mask;
+    rc_hash = (rc_hash >> 2) + ((uint64_t)(3 - base) << (2 * (K - 1)));
+
+    hash_kmer(hash, kmer_table_bits, buckets[b][0], tags[b][0]);
+    hash_kmer(rc_hash, kmer_table_bits, buckets[b][1], tags[b][1]);
+    for (int strand = 0; strand < 2; ++strand) {
+      if (options.index_layout == INDEX_CSR) {
+        __builtin_prefetch(&index.csr_offsets[buckets[b][strand]]);
+      } else {
+        __builtin_prefetch(&index.kmer_table[buckets[b][strand]]);
       }
-    } else {
-      current_length = 0;
     }
+  }
 
-    if (current_length > match_length) {
-      match_length = current_length;
-      match_ref_pos = k;
+  // Buckets are arriving, prefetch the candidate runs or first candidates
+  for (int b = 0; b < count; ++b) {
+    for (int strand = 0; strand < 2; ++strand) {
+      uint64_t idx = buckets[b][strand];
+      if (options.index_layout == INDEX_CSR) {
+        Pos first = index.csr_offsets[idx];
+        __builtin_prefetch(&index.csr_tags[first]);
+        __builtin_prefetch(&index.csr_positions[first]);
+      } else {
+        unsigned hits =
+            bucket_tag_mask(index.kmer_table[idx], tags[b][strand]);
+        if (hits) {
+          Pos k = index.kmer_table[idx].positions[__builtin_ctz(hits)];
+          __builtin_prefetch(&ref_seq_encoded[k]);
+        }
+      }
     }
   }
+
 }
 
-void compress_sequences() {
+template <int K>
+bool find_shifted_match(int64_t tar_pos, int64_t prev_ref_pos, bool reverse,
+                        int64_t& match_ref_pos, int64_t& match_length,
+                        int& inserted_count) {
   /**
-   * Write matches and mismatches based on reference and target sequence
-   * @author Lorena Švenjak
+   * Probe the reference diagonals next to the end of the previous match
+   * for a continuation after a short insertion, deletion or substitution
+   * Avoids a full hash lookup when the alignment only shifted a few bases
+   * A reverse match keeps walking the reference backwards
+   */
+  int64_t ref_size = ref_seq_encoded.size();
+  int64_t tar_size = target_seq_encoded.size();
+  int64_t min_length = max<int64_t>(K, options.min_match_length);
+  int direction = reverse ? -1 : 1;
+
+  // Prefer fewer inserted bases, then the smallest shift of the diagonal
+  for (int ins = 0; ins <= options.max_indel_length; ++ins) {
+    int64_t probe_tar_pos = tar_pos + ins;
+    if (probe_tar_pos + K > tar_size) {
+      return false;
+    }
+
+    for (int d = 0; d <= 2 * options.max_indel_length; ++d) {
+      int shift = (d & 1) ? -((d + 1) >> 1) : (d >> 1);
+      int64_t ref_pos = prev_ref_pos + direction * (ins + shift);
+      if ((ins == 0 && shift == 0) || ref_pos < 0 || ref_pos >= ref_size) {
+        continue;
+      }
+
+      int64_t current_length = extend_match(ref_pos, probe_tar_pos, reverse);
+      if (current_length >= min_length) {
+        match_ref_pos = ref_pos;
+        match_length = current_length;
+        inserted_count = ins;
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+template <int K, typename Pos>
+bool find_minimizer_match(int64_t tar_pos, int64_t literal_start,
+                          size_t& cursor, Match& match) {
+  /**
+   * Seed from the next target minimizer at or after tar_pos that hits the
+   * minimizer index, extending the seed in both directions
+   * The backward extension may reclaim pending literal bases down to
+   * literal_start, so match.tar_pos can lie before tar_pos
+   * cursor is the first target minimizer not yet passed
+   */
+  int64_t ref_size = ref_seq_encoded.size();
+  int64_t min_length = max<int64_t>(K, options.min_match_length);
+  match.length = 0;
+
+  while (cursor < target_minimizers.size() &&
+         target_minimizers[cursor].pos < tar_pos) {
+    cursor++;
+  }
+
+  for (; cursor < target_minimizers.size(); ++cursor) {
+    const Minimizer& seed = target_minimizers[cursor];
+    uint64_t idx;
+    uint16_t tag;
+    hash_kmer(seed.kmer, kmer_table_bits, idx, tag);
+    uint64_t walked = 0;
+
+    for_each_candidate<Pos>(idx, tag, [&](int64_t entry) {
+      int64_t k = entry >> 1;
+      bool reverse = (entry & 1) != seed.reverse;
+      int64_t start = reverse ? k + K - 1 : k;
+      int64_t forward = extend_match(start, seed.pos, reverse);
+      walked++;
+      if (forward < K) {
+        if (MATCHER_COUNTERS) {
+          matcher_counters.verify_rejected++;
+        }
+        return;
+      }
+
+      // Walk back along the same diagonal into the literal run
+      int64_t backward = 0;
+      int direction = reverse ? -1 : 1;
+      while (seed.pos - backward > literal_start) {
+        int64_t ref_pos = start - direction * (backward + 1);
+        if (ref_pos < 0 || ref_pos >= ref_size ||
+            (reverse ? 3 - ref_seq_encoded[ref_pos]
+                     : ref_seq_encoded[ref_pos]) !=
+                target_seq_encoded[seed.pos - backward - 1]) {
+          break;
+        }
+        backward++;
+      }
+
+      if (forward + backward > match.length) {
+        match.length = forward + backward;
+        match.tar_pos = seed.pos - backward;
+        match.ref_pos = start - direction * backward;
+        match.reverse = reverse;
+      }
+    });
+
+    if (MATCHER_COUNTERS) {
+      matcher_counters.hash_lookups++;
+      matcher_counters.candidates_walked += walked;
+      matcher_counters.chain_lengths.add(walked);
+    }
+    if (match.length >= min_length) {
+      return true;
+    }
+    match.length = 0;
+  }
+
+  return false;
+}
+
+void normalize_frequencies(const uint64_t* counts, uint64_t total,
+                           uint32_t* freqs) {
+  /**
+   * Scale byte counts to frequencies summing to RANS_PROB_SCALE, every
+   * byte that occurs keeps a frequency of at least one
+   */
+  uint32_t sum = 0;
+  for (int c = 0; c < 256; ++c) {
+    freqs[c] = 0;
+    if (counts[c]) {
+      freqs[c] = max<uint64_t>(1, counts[c] * RANS_PROB_SCALE / total);
+    }
+    sum += freqs[c];
+  }
+
+  // Rounding error is settled on the largest frequencies
+  uint32_t* largest = max_element(freqs, freqs + 256);
+  if (sum < RANS_PROB_SCALE) {
+    *largest += RANS_PROB_SCALE - sum;
+  }
+  while (sum > RANS_PROB_SCALE) {
+    largest = max_element(freqs, freqs + 256);
+    uint32_t step = min(sum - RANS_PROB_SCALE, *largest - 1);
+    *largest -= step;
+    sum -= step;
+  }
+}
+
+bool rans_encode(const string& input, string& output) {
+  /**
+   * Order 0 rANS over the bytes of a block with RANS_LANES interleaved
+   * states and 16 bit renormalization, byte i is coded by state i % lanes
+   * so the decoder can advance all lanes in one SIMD step
+   * Layout: byte count, bitmap of present bytes, their frequencies, the
+   * final states and the renormalization words in decoding order
+   * Returns false when coding does not make the block smaller
+   */
+  size_t n = input.size();
+  if (n < RANS_MIN_BLOCK) {
+    return false;
+  }
+
+  uint64_t counts[256] = {0};
+  for (unsigned char c : input) {
+    counts[c]++;
+  }
+  uint32_t freqs[256], cumulative[257];
+  normalize_frequencies(counts, n, freqs);
+  cumulative[0] = 0;
+  for (int c = 0; c < 256; ++c) {
+    cumulative[c + 1] = cumulative[c] + freqs[c];
+  }
+
+  // Code backwards so the decoder reads forwards
+  vector<uint16_t> words(n + 2 * RANS_LANES);
+  size_t position = words.size();
+  uint32_t states[RANS_LANES];
+  fill(states, states + RANS_LANES, RANS_LOWER_BOUND);
+  for (size_t i = n; i-- > 0;) {
+    unsigned char c = input[i];
+    uint32_t& x = states[i % RANS_LANES];
+    uint64_t x_max = (uint64_t)((RANS_LOWER_BOUND >> RANS_PROB_BITS) << 16) *
+                     freqs[c];
+    if (x >= x_max) {
+      words[--position] = (uint16_t)x;
+      x >>= 16;
+    }
+    x = ((x / freqs[c]) << RANS_PROB_BITS) + x % freqs[c] + cumulative[c];
+  }
+  for (int lane = RANS_LANES - 1; lane >= 0; --lane) {
+    words[--position] = (uint16_t)(states[lane] >> 16);
+    words[--position] = (uint16_t)states[lane];
+  }
+
+  output.clear();
+  put_varint(output, n);
+  char present[32] = {0};
+  for (int c = 0; c < 256; ++c) {
+    if (freqs[c]) {
+      present[c / 8] |= 1 << (c % 8);
+    }
+  }
+  output.append(present, sizeof(present));
+  for (int c = 0; c < 256; ++c) {
+    if (freqs[c]) {
+      put_varint(output, freqs[c] - 1);
+    }
+  }
+  output.append((const char*)&words[position],
+                (words.size() - position) * sizeof(uint16_t));
+
+  return output.size() < n;
+}
+
+void entropy_code_block(StreamBlock& block) {
+  /**
+   * rANS code a block when that saves space, otherwise keep its bytes
+   */
+  block.raw_size = block.bytes.size();
+  string coded;
+  if (rans_encode(block.bytes, coded)) {
+    block.bytes.swap(coded);
+    block.entropy = ENTROPY_RANS;
+  } else {
+    block.entropy = ENTROPY_NONE;
+  }
+}
+
+template <int K>
+void encode_records(SpscRing<vector<Record>>& records,
+                    SpscRing<future<StreamBlock>>& blocks, ThreadPool& coders) {
+  /**
+   * Encoder stage, splits records into their column streams and cuts every
+   * stream into blocks of about options.block_size bytes
+   * Blocks are entropy coded independently on the coder pool, the writer
+   * receives them in cut order
+   * The metadata streams are coded while the matcher starts up
+   */
+  PhaseTimer phase(PHASE_ENCODE);
+  StreamBlock streams[STREAM_COUNT];
+  for (int id = 0; id < STREAM_COUNT; ++id) {
+    streams[id].id = (StreamId)id;
+    streams[id].count = 0;
+  }
+
+  auto flush = [&](StreamBlock& stream) {
+    if (stream.count > 0) {
+      auto block = make_shared<StreamBlock>(StreamBlock{
+          stream.id, stream.count, move(stream.bytes), ENTROPY_NONE, 0});
+      blocks.push(coders.submit<StreamBlock>([block]() {
+        PhaseTimer phase(PHASE_ENTROPY);
+        entropy_code_block(*block);
+        return move(*block);
+      }));
+      stream.count = 0;
+      stream.bytes = string();
+    }
+  };
+  auto put_bases = [&](int64_t start, int64_t length) {
+    for (int64_t i = start; i < start + length; ++i) {
+      put_value(streams[STREAM_LITERAL_BASES], target_seq_encoded[i]);
+    }
+  };
+
+  encode_metadata(streams);
+  for (int id = 0; id < STREAM_RECORD_FLAGS; ++id) {
+    flush(streams[id]);
+  }
+
+  vector<Record> block;
+  while (records.pop(block)) {
+    for (const Record& record : block) {
+      if (record.type == RECORD_MATCH) {
+        put_value(streams[STREAM_RECORD_FLAGS], 1 | (record.reverse << 1));
+        put_value(streams[STREAM_REF_DELTAS], record.ref_delta);
+        put_value(streams[STREAM_MATCH_LENGTHS], record.length - K);
+        put_value(streams[STREAM_INSERTED_LENGTHS], record.literal_length);
+      } else {
+        put_value(streams[STREAM_RECORD_FLAGS], 0);
+        put_value(streams[STREAM_LITERAL_RUNS], record.literal_length);
+      }
+      put_bases(record.literal_start, record.literal_length);
+    }
+
+    for (int id = STREAM_RECORD_FLAGS; id < STREAM_COUNT; ++id) {
+      if (streams[id].bytes.size() >= options.block_size) {
+        flush(streams[id]);
+      }
+    }
+  }
+
+  for (int id = STREAM_RECORD_FLAGS; id < STREAM_COUNT; ++id) {
+    flush(streams[id]);
+  }
+  blocks.close();
+}
+
+void write_blocks(SpscRing<future<StreamBlock>>& blocks, ofstream& out,
+                  vector<StreamBlockEntry>& directory) {
+  /**
+   * Writer stage, appends stream blocks to the container in the order they
+   * were cut, waiting for each one to be coded, and records where it went
    */
-  vector<Match> matches;
-  vector<char> mismatches;
-  vector<int> encoded_mismatches;
-  matches.reserve(target_seq_encoded.size() / 100 + 1000);
-  mismatches.reserve(10000);
+  PhaseTimer phase(PHASE_WRITE);
+  future<StreamBlock> coded;
+  uint64_t offset = out.tellp();
+  while (blocks.pop(coded)) {
+    StreamBlock block = coded.get();
+    out.write(block.bytes.data(), block.bytes.size());
+    StreamStats& stats = stream_stats[block.id];
+    stats.blocks++;
+    stats.values += block.count;
+    stats.bytes_in += block.raw_size;
+    stats.bytes_out += block.bytes.size();
+    directory.push_back({(uint32_t)block.id, (uint32_t)STREAM_CODECS[block.id],
+                         (uint32_t)block.entropy, block.count, offset,
+                         block.bytes.size()});
+    offset += block.bytes.size();
+  }
+}
 
-  int tar_pos = 0;
-  int prev_ref_pos = 0;
-  int prev_tar_pos = 0;
-  int total_matched = 0;
-  int total_mismatched = 0;
+void write_container_header(ofstream& out) {
+  /**
+   * Fixed size header at the start of the container
+   */
+  uint32_t kmer_length = options.kmer_length;
+  uint32_t position_bits = options.position_bits;
+  out.write(CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+  out.write((const char*)&CONTAINER_VERSION, sizeof(CONTAINER_VERSION));
+  out.write((const char*)&kmer_length, sizeof(kmer_length));
+  out.write((const char*)&position_bits, sizeof(position_bits));
+}
 
-  string compressed_file = "output.txt";
+void write_container_directory(ofstream& out,
+                               const vector<StreamBlockEntry>& directory) {
+  /**
+   * Block directory at the end of the container, followed by its offset
+   * so a reader can find it without scanning the blocks
+   */
+  PhaseTimer phase(PHASE_WRITE);
+  uint64_t directory_offset = out.tellp();
+  uint64_t entry_count = directory.size();
+  out.write((const char*)&entry_count, sizeof(entry_count));
+  for (const StreamBlockEntry& entry : directory) {
+    out.write((const char*)&entry.id, sizeof(entry.id));
+    out.write((const char*)&entry.codec, sizeof(entry.codec));
+    out.write((const char*)&entry.entropy, sizeof(entry.entropy));
+    out.write((const char*)&entry.count, sizeof(entry.count));
+    out.write((const char*)&entry.offset, sizeof(entry.offset));
+    out.write((const char*)&entry.size, sizeof(entry.size));
+  }
+  out.write((const char*)&directory_offset, sizeof(directory_offset));
+}
 
-  ofstream out(compressed_file, ios::app);
+uint64_t histogram_bin_start(int bin) {
+  /**
+   * Smallest value counted in a histogram bin
+   */
+  return bin == 0 ? 0 : 1ULL << (bin - 1);
+}
+
+void print_matcher_counters() {
+  /**
+   * Text report of the matcher counters, histograms list the start of each
+   * non-empty bin with its count
+   */
+  const MatcherCounters& c = matcher_counters;
+  report() << "Hash lookups: " << c.hash_lookups << endl;
+  report() << "Candidates walked: " << c.candidates_walked
+           << ", rejected by tag: " << c.tag_rejected
+           << ", rejected by verification: " << c.verify_rejected << endl;
+  report() << "Bases compared: " << c.bases_compared << endl;
+
+  const pair<const char*, const Histogram*> histograms[] = {
+      {"Chain lengths", &c.chain_lengths},
+      {"Match lengths", &c.match_lengths},
+      {"Literal run lengths", &c.literal_runs}};
+  for (const auto& histogram : histograms) {
+    report() << histogram.first << ":";
+    for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
+      if (histogram.second->bins[bin]) {
+        report() << " " << histogram_bin_start(bin) << "+:"
+                 << histogram.second->bins[bin];
+      }
+    }
+    report() << endl;
+  }
+}
+
+template <int K, typename Pos>
+void compress_sequences() {
+  /**
+   * Write matches and mismatches based on reference and target sequence
+   * The matcher runs here and emits records, an encoder and a writer
+   * thread code and store them so matching never waits on output
+   * @author Lorena Švenjak
+   */
+  int64_t tar_pos = 0;
+  int64_t literal_start = 0;  // first base of the pending literal run
+  int64_t prev_ref_pos = 0;
+  int64_t total_matched = 0;
+  int64_t total_mismatched = 0;
+  int64_t total_indel_records = 0;
+  int64_t total_reverse_matched = 0;
+  bool after_match = false;
+  bool prev_reverse = false;
+  LookupBatch lookahead;
+  int64_t min_length = max<int64_t>(K, options.min_match_length);
+
+  string compressed_file = "compressed.hirgc";
+
+  ofstream out(compressed_file, ios::binary);
   if (!out) {
     throw runtime_error("Cannot open output file: " + compressed_file);
   }
+  write_container_header(out);
+
+  vector<StreamBlockEntry> directory;
+  SpscRing<vector<Record>> records(PIPELINE_RING_SIZE);
+  SpscRing<future<StreamBlock>> blocks(PIPELINE_RING_SIZE);
+  ThreadPool coders(options.threads);
+  thread encoder(encode_records<K>, ref(records), ref(blocks), ref(coders));
+  thread writer(write_blocks, ref(blocks), ref(out), ref(directory));
+
+  vector<Record> block;
+  block.reserve(RECORD_BLOCK_SIZE);
+  auto emit = [&](const Record& record) {
+    if (record.type == RECORD_MATCH) {
+      match_stats.match_records++;
+    } else {
+      match_stats.literal_records++;
+    }
+    if (MATCHER_COUNTERS) {
+      if (record.type == RECORD_MATCH) {
+        matcher_counters.match_lengths.add(record.length);
+      }
+      if (record.type == RECORD_LITERALS) {
+        matcher_counters.literal_runs.add(record.literal_length);
+      }
+    }
+    block.push_back(record);
+    if (block.size() == RECORD_BLOCK_SIZE) {
+      records.push(move(block));
+      block = vector<Record>();
+      block.reserve(RECORD_BLOCK_SIZE);
+    }
+  };
+
+  // Pending literal bases are emitted as one record before the next match
+  auto flush_literals = [&]() {
+    if (tar_pos > literal_start) {
+      emit({RECORD_LITERALS, false, 0, 0, literal_start,
+            tar_pos - literal_start});
+      total_mismatched += tar_pos - literal_start;
+    }
+  };
 
-  write_metadata(compressed_file);
+  PhaseTimer matching(PHASE_MATCH);
+  size_t minimizer_cursor = 0;
+  if (options.index_layout == INDEX_MINIMIZER) {
+    compute_minimizers<K>(target_seq_encoded, options.minimizer_window,
+                          target_minimizers);
+  }
 
-  while (tar_pos < target_seq_encoded.size()) {
-    int match_ref_pos, match_length;
-    find_longest_match(tar_pos, match_ref_pos, match_length);
+  while (tar_pos < (int64_t)target_seq_encoded.size()) {
+    int64_t match_ref_pos, match_length;
+    int inserted_count = 0;
+    bool match_reverse = prev_reverse;
+
+    // A match that stopped on a small indel usually resumes on a nearby
+    // diagonal, emit it as a single record with the inserted bases inline
+    if (after_match &&
+        find_shifted_match<K>(tar_pos, prev_ref_pos, prev_reverse,
+                              match_ref_pos, match_length, inserted_count)) {
+      total_mismatched += inserted_count;
+      if (inserted_count > 0) {
+        total_indel_records++;
+      }
+    } else if (options.index_layout == INDEX_MINIMIZER) {
+      // Only minimizer positions are indexed, jump to the next seed and
+      // take the bases before it as literals
+      Match match;
+      bool found = find_minimizer_match<K, Pos>(tar_pos, literal_start,
+                                                minimizer_cursor, match);
+      if (!found) {
+        tar_pos = target_seq_encoded.size();
+        continue;
+      }
 
-    if (match_length >= KMER_LENGTH) {
-      if (!mismatches.empty()) {
-        encode_sequence(mismatches, encoded_mismatches);
-        total_mismatched += encoded_mismatches.size();
-        for (size_t i = 0; i < encoded_mismatches.size(); ++i) {
-          out << encoded_mismatches[i];
-        }
-        out << '\n';
-
-        mismatches.clear();
-        encoded_mismatches.clear();
-      }
-      int delta_ref = match_ref_pos - prev_ref_pos;
-      int delta_tar = tar_pos - prev_tar_pos;
-      matches.push_back({delta_ref, delta_tar, match_length});
-      total_matched += match_length;
-      prev_ref_pos = match_ref_pos + match_length;
-      prev_tar_pos = tar_pos + match_length;
-      tar_pos += match_length;
-      out << delta_ref << " " << match_length - KMER_LENGTH << '\n';
+      tar_pos = match.tar_pos;
+      match_ref_pos = match.ref_pos;
+      match_length = match.length;
+      match_reverse = match.reverse;
+      flush_literals();
     } else {
-      mismatches.push_back(target_seq[tar_pos]);
-      tar_pos++;
+      if (after_match || options.index_layout == INDEX_FM) {
+        find_longest_match<K, Pos>(tar_pos, match_ref_pos, match_length,
+                                   match_reverse);
+      } else {
+        // Inside a literal stretch most lookups fail, resolve them in
+        // prefetched batches
+        if (tar_pos < lookahead.start || tar_pos >= lookahead.end) {
+          prepare_lookups<K, Pos>(tar_pos, lookahead);
+        }
+        if (tar_pos < lookahead.end) {
+          int slot = tar_pos - lookahead.start;
+          Match match;
+          resolve_longest_match<K, Pos>(tar_pos, lookahead.buckets[slot],
+                                        lookahead.tags[slot], match);
+          match_ref_pos = match.ref_pos;
+          match_length = match.length;
+          match_reverse = match.reverse;
+        } else {
+          match_length = 0;
+        }
+      }
+
+      if (match_length < min_length) {
+        tar_pos++;
+        after_match = false;
+        continue;
+      }
+
+      // Lazy matching, a match a few bases on takes over when it reaches
+      // further than the bases it turns into literals
+      int skip = 0;
+      for (int j = 1; j <= options.lazy_depth; ++j) {
+        int64_t later_ref_pos, later_length;
+        bool later_reverse;
+        find_longest_match<K, Pos>(tar_pos + j, later_ref_pos, later_length,
+                                   later_reverse);
+        if (later_length - j > match_length - skip) {
+          skip = j;
+          match_ref_pos = later_ref_pos;
+          match_length = later_length;
+          match_reverse = later_reverse;
+        }
+      }
+      tar_pos += skip;
+
+      flush_literals();
     }
-  }
 
-  if (!mismatches.empty()) {
-    encode_sequence(mismatches, encoded_mismatches);
-    total_mismatched += encoded_mismatches.size();
-    for (size_t i = 0; i < encoded_mismatches.size(); ++i) {
-      out << encoded_mismatches[i];
+    emit({RECORD_MATCH, match_reverse, match_ref_pos - prev_ref_pos,
+          match_length, tar_pos, inserted_count});
+    tar_pos += inserted_count;
+
+    // Reverse matches continue towards the start of the reference
+    if (match_reverse) {
+      total_reverse_matched += match_length;
     }
+    total_matched += match_length;
+    prev_ref_pos = match_reverse ? match_ref_pos - match_length
+                                 : match_ref_pos + match_length;
+    prev_reverse = match_reverse;
+    tar_pos += match_length;
+    literal_start = tar_pos;
+    after_match = true;
+  }
+
+  flush_literals();
+  if (!block.empty()) {
+    records.push(move(block));
   }
+  records.close();
+  matching.stop();
+  encoder.join();
+  writer.join();
 
+  write_container_directory(out, directory);
+  uint64_t compressed_size = out.tellp();
   out.close();
+  if (!out) {
+    throw runtime_error("Failed writing output file: " + compressed_file);
+  }
+
+  match_stats.matched_bases = total_matched;
+  match_stats.mismatched_bases = total_mismatched;
+  match_stats.reverse_matched_bases = total_reverse_matched;
+  match_stats.indel_records = total_indel_records;
+  match_stats.compressed_size = compressed_size;
 
-  cout << "Total matched bases: " << total_matched << endl;
-  cout << "Total mismatched bases: " << total_mismatched << endl;
-  cout << "Compression ratio: "
+  report() << "Total matched bases: " << total_matched << endl;
+  report() << "Total mismatched bases: " << total_mismatched << endl;
+  report() << "Small indel records: " << total_indel_records << endl;
+  report() << "Reverse complement matched bases: " << total_reverse_matched
+       << endl;
+  report() << "Compression ratio: "
        << (100.0 * (total_matched) / (total_matched + total_mismatched)) << "%"
        << endl;
-  cout << "Compressed data written to " << compressed_file << endl;
+  report() << "Compressed size: " << compressed_size << " bytes" << endl;
+  report() << "Compressed data written to " << compressed_file << endl;
+  if (MATCHER_COUNTERS) {
+    print_matcher_counters();
+  }
 }
 
-void compress_to_7z(const string& input_file, const string& archive_name) {
+template <int K>
+void compress_with_kmer_length(const InputFileNames& input_file_names,
+                               future<void>& target_ready) {
   /**
-   * Compress input file into a 7z archive
-   * @author Polina Rykova
+   * Index the reference and compress the target with k-mers of length K
+   * The target is still being loaded while the index is built, matching
+   * starts once both are done
    */
-  string command = "7z a -t7z " + archive_name + " " + input_file;
-  int result = system(command.c_str());
-  if (result != 0) {
-    throw runtime_error("7z compression failed");
+  // Largest stored value of the layout decides the width, a loaded index
+  // brings its own layout
+  IndexLayout layout = options.index_layout;
+  if (!input_file_names.index_load_file.empty()) {
+    layout = saved_index_layout(input_file_names.index_load_file);
+  }
+  int64_t n = ref_seq_encoded.size();
+  int64_t largest_position = n;  // reference positions
+  if (layout == INDEX_MINIMIZER) {
+    largest_position = 2 * n;  // position and strand bit
+  } else if (layout == INDEX_FM) {
+    largest_position = 2 * n + 2;  // both strands and two sentinels
+  }
+  if (largest_position <= MAX_NARROW_POSITION) {
+    options.position_bits = 32;
+    build_hash_table<K, int32_t>(input_file_names);
+    target_ready.get();
+    compress_sequences<K, int32_t>();
+  } else {
+    options.position_bits = 64;
+    build_hash_table<K, int64_t>(input_file_names);
+    target_ready.get();
+    compress_sequences<K, int64_t>();
   }
 }
 
@@ -531,7 +2638,6 @@ void cleanup() {
   lowercase_ranges.clear();
   n_ranges.clear();
   special_chars.clear();
-  line_breaks.clear();
   mismatch_buffer.clear();
 }
 
@@ -544,12 +2650,165 @@ void print_memory_usage() {
   std::string line;
   while (std::getline(status_file, line)) {
     if (line.substr(0, 6) == "VmRSS:") {
-      std::cout << "Memory usage: " << line.substr(6) << std::endl;
+      report() << "Memory usage: " << line.substr(6) << std::endl;
       break;
     }
   }
 }
 
+void print_huge_page_usage() {
+  /**
+   * Print how many 2 MiB pages back the process, both counts come from the
+   * kernel and only cover pages that were touched, advised is what the
+   * large arrays asked for
+   */
+  size_t explicit_kb = 0;
+  size_t transparent_kb = 0;
+  ifstream smaps_file("/proc/self/smaps_rollup");
+  string line;
+  while (getline(smaps_file, line)) {
+    if (line.compare(0, 14, "AnonHugePages:") == 0) {
+      transparent_kb = stoull(line.substr(14));
+    } else if (line.compare(0, 16, "Private_Hugetlb:") == 0) {
+      explicit_kb = stoull(line.substr(16));
+    }
+  }
+
+  report() << "Huge pages: " << explicit_kb * 1024 / HUGE_PAGE_SIZE
+       << " explicit, " << transparent_kb * 1024 / HUGE_PAGE_SIZE
+       << " transparent of "
+       << huge_page_usage.advised_bytes / HUGE_PAGE_SIZE << " advised"
+       << endl;
+}
+
+void print_numa_placement() {
+  /**
+   * Print how much of the large arrays the kernel actually interleaved,
+   * mappings it refused keep the default first touch placement
+   */
+  if (options.numa_mode != NUMA_INTERLEAVE) {
+    return;
+  }
+  report() << "NUMA: " << numa_interleaved_bytes / (1 << 20)
+       << " MiB interleaved";
+  if (numa_unbound_bytes > 0) {
+    report() << ", " << numa_unbound_bytes / (1 << 20)
+         << " MiB left on first touch placement";
+  }
+  report() << endl;
+}
+
+uint64_t read_status_kb(const string& key) {
+  /**
+   * Value of a kB field of /proc/self/status, such as "VmHWM:"
+   */
+  ifstream status_file("/proc/self/status");
+  string line;
+  while (getline(status_file, line)) {
+    if (line.compare(0, key.size(), key) == 0) {
+      return stoull(line.substr(key.size()));
+    }
+  }
+  return 0;
+}
+
+void print_stats_json(const InputFileNames& input_file_names) {
+  /**
+   * Report of --stats json on stdout, per phase wall and CPU time, bytes in
+   * and out per stream, records emitted and peak RSS
+   * Phase times are summed over the threads of a phase and phases overlap,
+   * so they do not add up to the total wall time
+   */
+  const char* index_names[] = {"tagged", "csr", "minimizer", "sa"};
+  printf("{\n");
+  printf("  \"reference_bytes\": %llu,\n",
+         (unsigned long long)file_size(input_file_names.reference_file));
+  printf("  \"target_bytes\": %llu,\n",
+         (unsigned long long)file_size(input_file_names.target_file));
+  printf("  \"compressed_bytes\": %llu,\n",
+         (unsigned long long)match_stats.compressed_size);
+  printf("  \"level\": %d,\n", options.level);
+  printf("  \"profile\": \"%s\",\n",
+         options.profile == PROFILE_DECODE_SPEED ? "decode-speed" : "default");
+  printf("  \"kmer_length\": %d,\n", options.kmer_length);
+  printf("  \"index\": \"%s\",\n", index_names[options.index_layout]);
+  printf("  \"position_bits\": %d,\n", options.position_bits);
+  printf("  \"threads\": %d,\n", options.threads);
+  printf("  \"block_size\": %zu,\n", options.block_size);
+  printf("  \"wall_ms\": %.3f,\n", timer / 1000.0);
+  printf("  \"peak_rss_kb\": %llu,\n",
+         (unsigned long long)read_status_kb("VmHWM:"));
+
+  printf("  \"phases\": {\n");
+  for (int phase = 0; phase < PHASE_COUNT; ++phase) {
+    printf("    \"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}%s\n",
+           PHASE_NAMES[phase], phase_times[phase].wall_ns / 1e6,
+           phase_times[phase].cpu_ns / 1e6,
+           phase + 1 < PHASE_COUNT ? "," : "");
+  }
+  printf("  },\n");
+
+  printf("  \"records\": {\"matches\": %lld, \"literal_runs\": %lld, "
+         "\"indels\": %lld},\n",
+         (long long)match_stats.match_records,
+         (long long)match_stats.literal_records,
+         (long long)match_stats.indel_records);
+  printf("  \"bases\": {\"matched\": %lld, \"mismatched\": %lld, "
+         "\"reverse_matched\": %lld},\n",
+         (long long)match_stats.matched_bases,
+         (long long)match_stats.mismatched_bases,
+         (long long)match_stats.reverse_matched_bases);
+
+  if (MATCHER_COUNTERS) {
+    const MatcherCounters& c = matcher_counters;
+    printf("  \"counters\": {\n");
+    printf("    \"hash_lookups\": %llu,\n",
+           (unsigned long long)c.hash_lookups);
+    printf("    \"candidates_walked\": %llu,\n",
+           (unsigned long long)c.candidates_walked);
+    printf("    \"tag_rejected\": %llu,\n",
+           (unsigned long long)c.tag_rejected);
+    printf("    \"verify_rejected\": %llu,\n",
+           (unsigned long long)c.verify_rejected);
+    printf("    \"bases_compared\": %llu,\n",
+           (unsigned long long)c.bases_compared);
+
+    // Histograms as [bin start, count] pairs of the non-empty bins
+    const pair<const char*, const Histogram*> histograms[] = {
+        {"chain_lengths", &c.chain_lengths},
+        {"match_lengths", &c.match_lengths},
+        {"literal_runs", &c.literal_runs}};
+    for (int h = 0; h < 3; ++h) {
+      printf("    \"%s\": [", histograms[h].first);
+      const char* separator = "";
+      for (int bin = 0; bin < HISTOGRAM_BINS; ++bin) {
+        if (histograms[h].second->bins[bin]) {
+          printf("%s[%llu, %llu]", separator,
+                 (unsigned long long)histogram_bin_start(bin),
+                 (unsigned long long)histograms[h].second->bins[bin]);
+          separator = ", ";
+        }
+      }
+      printf("]%s\n", h < 2 ? "," : "");
+    }
+    printf("  },\n");
+  }
+
+  printf("  \"streams\": {\n");
+  for (int id = 0; id < STREAM_COUNT; ++id) {
+    const StreamStats& stats = stream_stats[id];
+    printf("    \"%s\": {\"blocks\": %llu, \"values\": %llu, "
+           "\"bytes_in\": %llu, \"bytes_out\": %llu}%s\n",
+           STREAM_NAMES[id], (unsigned long long)stats.blocks,
+           (unsigned long long)stats.values,
+           (unsigned long long)stats.bytes_in,
+           (unsigned long long)stats.bytes_out,
+           id + 1 < STREAM_COUNT ? "," : "");
+  }
+  printf("  }\n");
+  printf("}\n");
+}
+
 int main(int argc, char* argv[]) {
   /**
    * Main function for compressing files using HIRGC algorithm.
@@ -560,38 +2819,199 @@ int main(int argc, char* argv[]) {
   gettimeofday(&timer_start, nullptr);
 
   // Check if passed arguments are valid
-  if (argc != 5) {
+  InputFileNames input_file_names;
+
+  for (int i = 1; i < argc; i += 2) {
+    // Levels are the only options without a value
+    if (argv[i][0] == '-' && argv[i][1] >= '1' && argv[i][1] <= '9' &&
+        argv[i][2] == '\0') {
+      options.level = argv[i][1] - '0';
+      i--;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      show_help_message("Missing value for argument " + string(argv[i]));
+      return 1;
+    }
+
+    if (strcmp(argv[i], "-r") == 0) {
+      input_file_names.reference_file = argv[i + 1];
+    } else if (strcmp(argv[i], "-t") == 0) {
+      input_file_names.target_file = argv[i + 1];
+    } else if (strcmp(argv[i], "-i") == 0) {
+      options.index_layout_set = true;
+      if (strcmp(argv[i + 1], "tagged") == 0) {
+        options.index_layout = INDEX_TAGGED;
+      } else if (strcmp(argv[i + 1], "csr") == 0) {
+        options.index_layout = INDEX_CSR;
+      } else if (strcmp(argv[i + 1], "minimizer") == 0) {
+        options.index_layout = INDEX_MINIMIZER;
+      } else if (strcmp(argv[i + 1], "sa") == 0) {
+        options.index_layout = INDEX_FM;
+      } else {
+        show_help_message("Unknown index layout " + string(argv[i + 1]));
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-k") == 0) {
+      options.kmer_length = atoi(argv[i + 1]);
+      if (options.kmer_length < 12 || options.kmer_length > 32 ||
+          options.kmer_length % 4 != 0) {
+        show_help_message(
+            "K-mer length must be one of 12, 16, 20, 24, 28, 32.");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "-w") == 0) {
+      options.minimizer_window = atoi(argv[i + 1]);
+      if (options.minimizer_window < 1) {
+        show_help_message("Minimizer window must be positive.");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--huge-pages") == 0) {
+      if (strcmp(argv[i + 1], "auto") == 0) {
+        options.huge_pages = HUGE_PAGES_AUTO;
+      } else if (strcmp(argv[i + 1], "thp") == 0) {
+        options.huge_pages = HUGE_PAGES_TRANSPARENT;
+      } else if (strcmp(argv[i + 1], "off") == 0) {
+        options.huge_pages = HUGE_PAGES_OFF;
+      } else {
+        show_help_message("Unknown huge page mode " + string(argv[i + 1]));
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--numa") == 0) {
+      if (strcmp(argv[i + 1], "off") == 0) {
+        options.numa_mode = NUMA_OFF;
+      } else if (strcmp(argv[i + 1], "interleave") == 0) {
+        options.numa_mode = NUMA_INTERLEAVE;
+      } else if (strcmp(argv[i + 1], "local") == 0) {
+        options.numa_mode = NUMA_LOCAL;
+      } else if (isdigit(argv[i + 1][0])) {
+        options.numa_mode = NUMA_LOCAL;
+        options.numa_node = atoi(argv[i + 1]);
+      } else {
+        show_help_message("Unknown NUMA mode " + string(argv[i + 1]));
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--block-size") == 0) {
+      options.block_size = (size_t)atol(argv[i + 1]) << 10;
+      if (options.block_size < MIN_BLOCK_SIZE) {
+        show_help_message("Block size must be at least 4 KiB.");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--threads") == 0) {
+      options.threads = atoi(argv[i + 1]);
+      if (options.threads < 1) {
+        show_help_message("Thread count must be positive.");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      if (strcmp(argv[i + 1], "default") == 0) {
+        options.profile = PROFILE_DEFAULT;
+      } else if (strcmp(argv[i + 1], "decode-speed") == 0) {
+        options.profile = PROFILE_DECODE_SPEED;
+      } else {
+        show_help_message("Unknown profile " + string(argv[i + 1]));
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      if (strcmp(argv[i + 1], "text") == 0) {
+        options.stats_format = STATS_TEXT;
+      } else if (strcmp(argv[i + 1], "json") == 0) {
+        options.stats_format = STATS_JSON;
+      } else {
+        show_help_message("Unknown stats format " + string(argv[i + 1]));
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--save-index") == 0) {
+      input_file_names.index_save_file = argv[i + 1];
+    } else if (strcmp(argv[i], "--load-index") == 0) {
+      input_file_names.index_load_file = argv[i + 1];
+    } else {
+      show_help_message("Invalid arguments.");
+      return 1;
+    }
+  }
+
+  if (input_file_names.reference_file.empty() ||
+      input_file_names.target_file.empty()) {
     show_help_message("Invalid number of arguments.");
     return 1;
   }
+  apply_compression_level(options.level);
+  apply_format_profile();
+  if (options.threads == 0) {
+    options.threads = max(1U, thread::hardware_concurrency());
+  }
 
-  if (strcmp(argv[1], "-r") != 0 || strcmp(argv[3], "-t") != 0) {
-    show_help_message("Invalid arguments.");
+  // Saved indexes are in CSR layout, the minimizer index is one as well
+  if ((!input_file_names.index_save_file.empty() ||
+       !input_file_names.index_load_file.empty()) &&
+      options.index_layout == INDEX_TAGGED) {
+    show_help_message("The tagged index cannot be saved or loaded.");
+    return 1;
+  }
+  if (!input_file_names.index_load_file.empty() &&
+      options.index_layout == INDEX_FM) {
+    show_help_message("A loaded index cannot be used with -i sa.");
+    return 1;
+  }
+  if (!input_file_names.index_save_file.empty() &&
+      options.index_layout == INDEX_FM) {
+    show_help_message("The suffix array index cannot be saved.");
+    return 1;
+  }
+  // The interleave policy is bound to the mmap backed arrays only
+  if (options.numa_mode == NUMA_INTERLEAVE &&
+      options.huge_pages == HUGE_PAGES_OFF) {
+    show_help_message("--numa interleave needs --huge-pages auto or thp.");
     return 1;
   }
-
-  InputFileNames input_file_names;
-
-  input_file_names.reference_file = argv[2];
-  input_file_names.target_file = argv[4];
-
-  initialize_structures();
 
   try {
+    setup_numa_placement();
+    initialize_structures();
+
+    PhaseTimer loading(PHASE_LOAD);
     load_sequence(input_file_names.reference_file, ref_seq, ref_seq_encoded,
                   false);
-    load_sequence(input_file_names.target_file, target_seq, target_seq_encoded,
-                  true);
-
-    process_target_sequence();
-    build_hash_table();
-    compress_sequences();
-
-    compress_to_7z("output.txt", "compressed.7z");
-    remove("output.txt");
+    loading.stop();
+
+    // Target parsing and mask extraction do not touch the reference, run
+    // them alongside the index build, get() rethrows their errors
+    future<void> target_ready = async(launch::async, [&]() {
+      PhaseTimer target_loading(PHASE_LOAD);
+      load_sequence(input_file_names.target_file, target_seq,
+                    target_seq_encoded, true);
+      target_loading.stop();
+      PhaseTimer masks(PHASE_MASKS);
+      process_target_sequence();
+    });
+
+    // Hash, verify and extend kernels are specialized per k-mer length
+    switch (options.kmer_length) {
+      case 12:
+        compress_with_kmer_length<12>(input_file_names, target_ready);
+        break;
+      case 16:
+        compress_with_kmer_length<16>(input_file_names, target_ready);
+        break;
+      case 20:
+        compress_with_kmer_length<20>(input_file_names, target_ready);
+        break;
+      case 24:
+        compress_with_kmer_length<24>(input_file_names, target_ready);
+        break;
+      case 28:
+        compress_with_kmer_length<28>(input_file_names, target_ready);
+        break;
+      case 32:
+        compress_with_kmer_length<32>(input_file_names, target_ready);
+        break;
+    }
 
-    cout << "Compression completed successfully." << endl;
+    report() << "Compression completed successfully." << endl;
     print_memory_usage();
+    print_huge_page_usage();
+    print_numa_placement();
   } catch (const exception& e) {
     cerr << "Error: " << e.what() << endl;
     cleanup();
@@ -605,7 +3025,11 @@ int main(int argc, char* argv[]) {
 
   timer = 1000000 * (timer_end.tv_sec - timer_start.tv_sec) +
           timer_end.tv_usec - timer_start.tv_usec;
-  printf("Total compresion time : %lf ms; \n", timer / 1000.0);
+  if (options.stats_format == STATS_JSON) {
+    print_stats_json(input_file_names);
+  } else {
+    printf("Total compresion time : %lf ms; \n", timer / 1000.0);
+  }
 
   return 0;
 }
\ No newline at end of file
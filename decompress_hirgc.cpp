@@ -1,32 +1,89 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
 using namespace std;
 
-const int MAX_SEQ_LENGTH = 1 << 28;
-const int KMER_LENGTH = 20;
+const int MAX_SEQ_LENGTH = 1 << 28;  // initial capacity, not a limit
 const vector<char> decode_into_base = {'A', 'C', 'G', 'T'};
+const char CONTAINER_MAGIC[8] = {'H', 'I', 'R', 'G', 'C', 'S', 'T', 'R'};
+const uint32_t CONTAINER_VERSION = 3;
+const int RANS_PROB_BITS = 12;
+const uint32_t RANS_PROB_SCALE = 1 << RANS_PROB_BITS;
+const uint32_t RANS_LOWER_BOUND = 1 << 16;
+const int RANS_LANES = 8;
 
 struct InputFileNames {
   string reference_file;
   string compressed_target_file;
 };
 
+// Streams of the container, in the order of compress_hirgc.cpp
+enum StreamId {
+  STREAM_HEADER,
+  STREAM_LINE_LENGTHS,
+  STREAM_LOWERCASE_RANGES,
+  STREAM_N_RANGES,
+  STREAM_SPECIAL_GAPS,
+  STREAM_SPECIAL_CHARS,
+  STREAM_RECORD_FLAGS,
+  STREAM_REF_DELTAS,
+  STREAM_MATCH_LENGTHS,
+  STREAM_INSERTED_LENGTHS,
+  STREAM_LITERAL_RUNS,
+  STREAM_LITERAL_BASES,
+  STREAM_COUNT
+};
+
+enum StreamCodec {
+  CODEC_RAW,
+  CODEC_VARINT,
+  CODEC_ZIGZAG_VARINT,
+  CODEC_PACKED_2BIT
+};
+
+enum EntropyCoder { ENTROPY_NONE, ENTROPY_RANS };
+
+struct StreamBlockEntry {
+  uint32_t id;
+  uint32_t codec;
+  uint32_t entropy;
+  uint64_t count;
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Values of one stream, byte codecs fill symbols and varint codecs numbers
+struct DecodedStream {
+  vector<uint8_t> symbols;
+  vector<uint64_t> numbers;
+};
+
 vector<char> ref_seq;
 vector<char> target_seq;
 string header;
-vector<int> line_lenghts;
-vector<int> lower_case_ranges;
-vector<int> n_ranges;
-vector<int> special_chars;
-vector<int> special_chars_order;
-int ref_seq_position = 0;
+DecodedStream streams[STREAM_COUNT];
+int64_t ref_seq_position = 0;
+int kmer_length = 0;
+int position_bits = 32;
+int decoder_threads = 0;  // block decoding threads, 0 for one per core
+char complement_base[256];
+bool has_ssse3 = false;  // byte shuffles for the copy loops
 unsigned long timer;
 struct timeval timer_start, timer_end;
 
@@ -38,7 +95,7 @@ void show_help_message(string reason) {
    */
   cout << "Error: " << reason << endl;
   cout << "Usage: ./decompress_hirgc -r <reference_file_name> -t "
-          "<target_file_compressed>"
+          "<target_file_compressed> [--threads <count>]"
        << endl;
 }
 
@@ -48,6 +105,17 @@ void initialize_structures() {
    */
   ref_seq.reserve(MAX_SEQ_LENGTH);
   target_seq.reserve(MAX_SEQ_LENGTH);
+
+  // Complement table for reverse complement matches
+  memset(complement_base, 'N', sizeof(complement_base));
+  complement_base['A'] = 'T';
+  complement_base['C'] = 'G';
+  complement_base['G'] = 'C';
+  complement_base['T'] = 'A';
+
+#if defined(__x86_64__) || defined(__i386__)
+  has_ssse3 = __builtin_cpu_supports("ssse3");
+#endif
 }
 
 void load_and_clean_reference(const string& filename, vector<char>& ref_seq) {
@@ -82,220 +150,542 @@ void load_and_clean_reference(const string& filename, vector<char>& ref_seq) {
   }
 }
 
-void load_metadata(const string& filename) {
+uint64_t get_varint(const uint8_t*& bytes, const uint8_t* end) {
   /**
-   * Load metadata from the compressed target file
-   * Read the header, line lengths, lowercase ranges,
-   * N ranges and special characters
-   * @author Polina Rykova
+   * Read one LEB128 value and advance past it
    */
+  uint64_t value = 0;
+  int shift = 0;
+  do {
+    if (bytes == end || shift > 63) {
+      throw runtime_error("Corrupt stream block");
+    }
+    value |= (uint64_t)(*bytes & 0x7F) << shift;
+    shift += 7;
+  } while (*bytes++ & 0x80);
+  return value;
+}
 
-  ifstream file(filename, ios::binary);
-  if (!file) {
-    throw runtime_error("Cannot open file: " + filename);
-  }
-
-  string temp;
-  int curr;
-
-  // Read the header line
-  getline(file, temp);
-  header = temp;
-
-  getline(file, temp);  // Skip empty line after header
-
-  // Read the line lengths
-  getline(file, temp);
-  curr = temp[0] - '0';
-
-  for (size_t i = 1; i < temp.size(); ++i) {
-    char c = temp[i];
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1"))) size_t rans_decode_sse41(
+    uint32_t* states, const uint8_t* words, size_t word_count,
+    size_t& word_pos, const uint32_t* slots, const uint8_t* symbols,
+    uint8_t* out, size_t n) {
+  /**
+   * Decode groups of RANS_LANES bytes, one per lane, with the state update
+   * and renormalization of four lanes per instruction
+   * Lanes that fall below the bound take the next 16 bit words in lane
+   * order, placed by a shuffle chosen from the mask of those lanes
+   * Returns the number of bytes decoded, the rest is left to the caller
+   */
+  // Built once by the first caller, the initialization of a local static
+  // is thread safe, so concurrent block decoders wait for it
+  struct alignas(16) ShuffleTable {
+    uint8_t masks[16][16];
+  };
+  static const ShuffleTable shuffles = []() {
+    ShuffleTable table;
+    for (int mask = 0; mask < 16; ++mask) {
+      int word = 0;
+      for (int lane = 0; lane < 4; ++lane) {
+        bool refill = mask & (1 << lane);
+        table.masks[mask][4 * lane] = refill ? 2 * word : 0x80;
+        table.masks[mask][4 * lane + 1] = refill ? 2 * word + 1 : 0x80;
+        table.masks[mask][4 * lane + 2] = 0x80;
+        table.masks[mask][4 * lane + 3] = 0x80;
+        word += refill;
+      }
+    }
+    return table;
+  }();
+
+  const __m128i slot_mask = _mm_set1_epi32(RANS_PROB_SCALE - 1);
+  const __m128i low_mask = _mm_set1_epi32(0xFFFF);
+  const __m128i sign = _mm_set1_epi32(0x80000000);
+  const __m128i bound = _mm_set1_epi32(RANS_LOWER_BOUND ^ 0x80000000);
+  __m128i x[2] = {_mm_loadu_si128((const __m128i*)states),
+                  _mm_loadu_si128((const __m128i*)(states + 4))};
+
+  size_t i = 0;
+  for (; i + RANS_LANES <= n && word_count - word_pos >= RANS_LANES;
+       i += RANS_LANES) {
+    alignas(16) uint32_t slot[RANS_LANES];
+    alignas(16) uint32_t entry[RANS_LANES];
+    _mm_store_si128((__m128i*)slot, _mm_and_si128(x[0], slot_mask));
+    _mm_store_si128((__m128i*)(slot + 4), _mm_and_si128(x[1], slot_mask));
+    for (int lane = 0; lane < RANS_LANES; ++lane) {
+      out[i + lane] = symbols[slot[lane]];
+      entry[lane] = slots[slot[lane]];
+    }
 
-    if (c == ' ') {
-      line_lenghts.push_back(curr);
-      curr = 0;
-    } else {
-      curr = curr * 10 + (c - '0');
+    for (int half = 0; half < 2; ++half) {
+      // x = freq * (x >> PROB_BITS) + slot - cumulative
+      __m128i e = _mm_load_si128((const __m128i*)(entry + 4 * half));
+      __m128i freq = _mm_and_si128(e, low_mask);
+      __m128i bias = _mm_srli_epi32(e, 16);
+      __m128i v = _mm_add_epi32(
+          _mm_mullo_epi32(freq, _mm_srli_epi32(x[half], RANS_PROB_BITS)),
+          bias);
+
+      __m128i refill = _mm_cmplt_epi32(_mm_xor_si128(v, sign), bound);
+      int mask = _mm_movemask_ps(_mm_castsi128_ps(refill));
+      __m128i next = _mm_loadl_epi64((const __m128i*)(words + 2 * word_pos));
+      next = _mm_shuffle_epi8(next, *(const __m128i*)shuffles.masks[mask]);
+      x[half] = _mm_blendv_epi8(
+          v, _mm_or_si128(_mm_slli_epi32(v, 16), next), refill);
+      word_pos += __builtin_popcount(mask);
     }
   }
-  line_lenghts.push_back(curr);
 
-  // Read the lowercase ranges
-  getline(file, temp);
-  curr = temp[0] - '0';
-
-  for (size_t i = 1; i < temp.size(); ++i) {
-    char c = temp[i];
+  _mm_storeu_si128((__m128i*)states, x[0]);
+  _mm_storeu_si128((__m128i*)(states + 4), x[1]);
+  return i;
+}
+#endif
 
-    if (c == ' ') {
-      lower_case_ranges.push_back(curr);
-      curr = 0;
-    } else {
-      curr = curr * 10 + (c - '0');
+void rans_decode(const uint8_t* bytes, const uint8_t* end,
+                 uint64_t max_size, vector<uint8_t>& out) {
+  /**
+   * Decode a block written by rans_encode() in compress_hirgc.cpp
+   * Full groups of lanes go through the SSE4.1 decoder when the CPU has
+   * it, the scalar loop finishes the block and checks the final states
+   */
+  uint64_t n = get_varint(bytes, end);
+  if (n > max_size || end - bytes < 32) {
+    throw runtime_error("Corrupt rANS block");
+  }
+  const uint8_t* present = bytes;
+  bytes += 32;
+
+  // Slot tables, freq in the low and slot - cumulative in the high half
+  vector<uint32_t> slots(RANS_PROB_SCALE);
+  vector<uint8_t> symbols(RANS_PROB_SCALE);
+  uint32_t cumulative = 0;
+  for (int c = 0; c < 256; ++c) {
+    if (!(present[c / 8] & (1 << (c % 8)))) {
+      continue;
+    }
+    uint64_t freq = get_varint(bytes, end) + 1;
+    if (freq > RANS_PROB_SCALE - cumulative) {
+      throw runtime_error("Corrupt rANS block");
+    }
+    for (uint32_t slot = cumulative; slot < cumulative + freq; ++slot) {
+      slots[slot] = freq | ((slot - cumulative) << 16);
+      symbols[slot] = c;
     }
+    cumulative += freq;
+  }
+  size_t word_count = (end - bytes) / 2;
+  if (cumulative != RANS_PROB_SCALE || word_count < 2 * RANS_LANES) {
+    throw runtime_error("Corrupt rANS block");
   }
-  lower_case_ranges.push_back(curr);
-
-  // Read the N ranges
-  getline(file, temp);
-  curr = temp[0] - '0';
-
-  for (size_t i = 1; i < temp.size(); ++i) {
-    char c = temp[i];
 
-    if (c == ' ') {
-      n_ranges.push_back(curr);
-      curr = 0;
-    } else {
-      curr = curr * 10 + (c - '0');
+  auto read_word = [&](size_t pos) {
+    return (uint32_t)bytes[2 * pos] | (uint32_t)bytes[2 * pos + 1] << 8;
+  };
+  uint32_t states[RANS_LANES];
+  for (int lane = 0; lane < RANS_LANES; ++lane) {
+    states[lane] = read_word(2 * lane) | read_word(2 * lane + 1) << 16;
+  }
+  size_t word_pos = 2 * RANS_LANES;
+
+  size_t start = out.size();
+  out.resize(start + n);
+  uint8_t* output = &out[start];
+  size_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("sse4.1")) {
+    i = rans_decode_sse41(states, bytes, word_count, word_pos, slots.data(),
+                          symbols.data(), output, n);
+  }
+#endif
+  for (; i < n; ++i) {
+    uint32_t& x = states[i % RANS_LANES];
+    uint32_t slot = x & (RANS_PROB_SCALE - 1);
+    output[i] = symbols[slot];
+    x = (slots[slot] & 0xFFFF) * (x >> RANS_PROB_BITS) + (slots[slot] >> 16);
+    if (x < RANS_LOWER_BOUND) {
+      if (word_pos == word_count) {
+        throw runtime_error("Corrupt rANS block");
+      }
+      x = x << 16 | read_word(word_pos++);
     }
   }
-  n_ranges.push_back(curr);
-
-  // Read the special characters
-  getline(file, temp);
-  int order_list_start = temp.rfind(' ') + 1;
-  curr = temp[0] - '0';
 
-  for (size_t i = 1; i < order_list_start; ++i) {
-    char c = temp[i];
-
-    if (c == ' ') {
-      special_chars.push_back(curr);
-      curr = 0;
-    } else {
-      curr = curr * 10 + (c - '0');
+  for (int lane = 0; lane < RANS_LANES; ++lane) {
+    if (states[lane] != RANS_LOWER_BOUND) {
+      throw runtime_error("Corrupt rANS block");
     }
   }
-  special_chars.push_back(curr);
+}
+
+void decode_block(const char* data, const StreamBlockEntry& entry,
+                  DecodedStream& stream, uint64_t first) {
+  /**
+   * Decode one block of a stream into its values starting at index first,
+   * blocks are independent so any number can be decoded at once
+   * rANS coded blocks are first expanded to the bytes of their codec
+   */
+  const uint8_t* bytes = (const uint8_t*)data;
+  const uint8_t* end = bytes + entry.size;
+
+  vector<uint8_t> expanded;
+  if (entry.entropy == ENTROPY_RANS) {
+    // No codec spends more than 10 bytes on a value
+    rans_decode(bytes, end, entry.count * 10, expanded);
+    bytes = expanded.data();
+    end = bytes + expanded.size();
+  } else if (entry.entropy != ENTROPY_NONE) {
+    throw runtime_error("Unknown entropy coder");
+  }
+  uint64_t size = end - bytes;
 
-  for (int i = order_list_start; i < temp.size(); ++i) {
-    char c = temp[i];
-    special_chars_order.push_back(c - '0');
+  switch (entry.codec) {
+    case CODEC_RAW:
+      if (entry.count != size) {
+        throw runtime_error("Corrupt stream block");
+      }
+      copy(bytes, end, stream.symbols.begin() + first);
+      break;
+    case CODEC_PACKED_2BIT:
+      if (size != (entry.count + 3) / 4) {
+        throw runtime_error("Corrupt stream block");
+      }
+      for (uint64_t i = 0; i < entry.count; ++i) {
+        stream.symbols[first + i] = (bytes[i / 4] >> (2 * (i % 4))) & 3;
+      }
+      break;
+    case CODEC_VARINT:
+    case CODEC_ZIGZAG_VARINT:
+      for (uint64_t i = 0; i < entry.count; ++i) {
+        uint64_t value = get_varint(bytes, end);
+        if (entry.codec == CODEC_ZIGZAG_VARINT) {
+          value = (value >> 1) ^ -(value & 1);
+        }
+        stream.numbers[first + i] = value;
+      }
+      break;
+    default:
+      throw runtime_error("Unknown stream codec");
   }
 }
 
-void decompress_target_sequence(const string& filename,
-                                vector<char>& target_seq) {
+void load_container(const string& filename) {
   /**
-   * Decompress the target sequence using the compressed file info
-   * Reconstruct the target sequence using the reference sequence and the
-   * mismatch data
+   * Read the compressed container and decode its blocks in parallel
+   * The directory gives every block its value count, so each block knows
+   * where its values go before any block is decoded
    * @author Polina Rykova
    */
-
   ifstream file(filename, ios::binary);
   if (!file) {
     throw runtime_error("Cannot open file: " + filename);
   }
+  string data((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+  const size_t header_size = sizeof(CONTAINER_MAGIC) + 3 * sizeof(uint32_t);
+  uint32_t version, k, width;
+  uint64_t directory_offset, entry_count;
+  if (data.size() < header_size + 2 * sizeof(uint64_t) ||
+      memcmp(data.data(), CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0) {
+    throw runtime_error("Not a compressed container: " + filename);
+  }
+  memcpy(&version, &data[8], sizeof(version));
+  memcpy(&k, &data[12], sizeof(k));
+  memcpy(&width, &data[16], sizeof(width));
+  memcpy(&directory_offset, &data[data.size() - sizeof(uint64_t)],
+         sizeof(directory_offset));
+  if (version != CONTAINER_VERSION || (width != 32 && width != 64) ||
+      directory_offset < header_size ||
+      directory_offset > data.size() - 2 * sizeof(uint64_t)) {
+    throw runtime_error("Unsupported container: " + filename);
+  }
+  kmer_length = k;
+  position_bits = width;
+
+  // Block directory, blocks of a stream are listed in stream order
+  const size_t entry_size = 3 * sizeof(uint32_t) + 3 * sizeof(uint64_t);
+  memcpy(&entry_count, &data[directory_offset], sizeof(entry_count));
+  if (entry_count > (data.size() - directory_offset) / entry_size) {
+    throw runtime_error("Corrupt container directory: " + filename);
+  }
+  vector<StreamBlockEntry> blocks;
+  vector<uint64_t> first_value;  // index of each block's first value
+  uint64_t stream_size[STREAM_COUNT] = {0};
+  int stream_codec[STREAM_COUNT];
+  fill(stream_codec, stream_codec + STREAM_COUNT, -1);
+  const char* entry_data = &data[directory_offset + sizeof(entry_count)];
+  for (uint64_t i = 0; i < entry_count; ++i, entry_data += entry_size) {
+    StreamBlockEntry entry;
+    memcpy(&entry.id, entry_data, sizeof(entry.id));
+    memcpy(&entry.codec, entry_data + 4, sizeof(entry.codec));
+    memcpy(&entry.entropy, entry_data + 8, sizeof(entry.entropy));
+    memcpy(&entry.count, entry_data + 12, sizeof(entry.count));
+    memcpy(&entry.offset, entry_data + 20, sizeof(entry.offset));
+    memcpy(&entry.size, entry_data + 28, sizeof(entry.size));
+    if (entry.id >= STREAM_COUNT || entry.offset > directory_offset ||
+        entry.size > directory_offset - entry.offset ||
+        (stream_codec[entry.id] != -1 &&
+         stream_codec[entry.id] != (int)entry.codec)) {
+      throw runtime_error("Corrupt container directory: " + filename);
+    }
+    stream_codec[entry.id] = entry.codec;
+    first_value.push_back(stream_size[entry.id]);
+    stream_size[entry.id] += entry.count;
+    blocks.push_back(entry);
+  }
 
-  // Skip the header and metadata lines
-  string temp;
-  for (int i = 0; i < 6; ++i) {
-    getline(file, temp);
+  for (int id = 0; id < STREAM_COUNT; ++id) {
+    if (stream_codec[id] == CODEC_RAW ||
+        stream_codec[id] == CODEC_PACKED_2BIT) {
+      streams[id].symbols.resize(stream_size[id]);
+    } else {
+      streams[id].numbers.resize(stream_size[id]);
+    }
   }
 
-  while (getline(file, temp)) {
-    // If there's no space in the line it's a mismatch
-    // the values are copied from compressed file
-    if (temp.find(' ') == string::npos) {
-      for (int i = 0; i < temp.size(); i++) {
-        char c = temp[i];
-        target_seq.push_back(decode_into_base[c - '0']);
-      }
-    } else {  // If there's a space it's a match, read from reference
-
-      // Read the position and length of the match
-      int position = 0;
-      int counter = 0;
-      int curr = 0;
-      int mult = 1;
-
-      for (int i = 0; i < temp.size(); i++) {
-        if (temp[i] == '-') {
-          mult = -1;
-          continue;
-        }
+  // Workers take the next undecoded block until none are left
+  atomic<size_t> next_block(0);
+  auto decode_blocks = [&]() {
+    for (size_t i; (i = next_block++) < blocks.size();) {
+      const StreamBlockEntry& entry = blocks[i];
+      decode_block(&data[entry.offset], entry, streams[entry.id],
+                   first_value[i]);
+    }
+  };
+  size_t worker_count = decoder_threads;
+  if (worker_count == 0) {
+    worker_count = max(1U, thread::hardware_concurrency());
+  }
+  worker_count = min(worker_count, max(blocks.size(), (size_t)1));
+  vector<future<void>> workers;
+  for (size_t i = 1; i < worker_count; ++i) {
+    workers.push_back(async(launch::async, decode_blocks));
+  }
+  decode_blocks();
+  for (auto& worker : workers) {
+    worker.get();
+  }
 
-        if (temp[i] == ' ') {
-          position = curr;
-          curr = 0;
-          continue;
-        }
-        curr = curr * 10 + mult * (temp[i] - '0');
-      }
+  header.assign(streams[STREAM_HEADER].symbols.begin(),
+                streams[STREAM_HEADER].symbols.end());
+}
 
-      counter = curr * mult;
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("ssse3"))) int64_t reverse_complement_ssse3(
+    const char* source, int64_t length, char* out) {
+  /**
+   * Reverse complement 16 bases per step, source points at the first base
+   * copied and walks backwards
+   * A, C, G and T differ in their low nibble, so one shuffle reverses the
+   * bytes and a second one looks up the complements
+   * Returns the number of bases copied, the rest is left to the caller
+   */
+  const __m128i reverse =
+      _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  const __m128i complement = _mm_setr_epi8(0, 'T', 0, 'G', 'A', 0, 0, 'C', 0,
+                                           0, 0, 0, 0, 0, 0, 0);
+  int64_t i = 0;
+  for (; i + 16 <= length; i += 16) {
+    __m128i bases = _mm_loadu_si128((const __m128i*)(source - i - 15));
+    bases = _mm_shuffle_epi8(bases, reverse);
+    _mm_storeu_si128((__m128i*)(out + i),
+                     _mm_shuffle_epi8(complement, bases));
+  }
+  return i;
+}
 
-      // Write matched bases from the reference sequence
-      ref_seq_position += position;
-      for (int i = 0; i < counter + KMER_LENGTH; i++) {
-        target_seq.push_back(ref_seq[ref_seq_position]);
-        ref_seq_position++;
-      }
-    }
+__attribute__((target("ssse3"))) uint64_t expand_bases_ssse3(
+    const uint8_t* symbols, uint64_t count, char* out) {
+  /**
+   * Map 16 literal symbols per step to their bases
+   * Returns the number of bases written, the rest is left to the caller
+   */
+  const __m128i bases = _mm_setr_epi8('A', 'C', 'G', 'T', 0, 0, 0, 0, 0, 0,
+                                      0, 0, 0, 0, 0, 0);
+  uint64_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(symbols + i));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_shuffle_epi8(bases, chunk));
   }
+  return i;
 }
+#endif
 
-void add_special_characters(vector<char>& target_seq) {
+void decompress_target_sequence(vector<char>& target_seq) {
   /**
-   * Add special characters to the target sequence
-   * based on the special character ranges
+   * Reconstruct the cleaned target sequence from the record streams
+   * Literal runs are copied from the literal bases, matches from the
+   * reference, a reverse match copies the complement walking towards the
+   * start of the reference
+   * The length is known from the streams, so the sequence is sized once
+   * and forward matches are plain memcpy calls
    * @author Polina Rykova
    */
-  int special_char_num = special_chars[0];
-  int unique_special_chars_num = special_chars[special_char_num + 1];
-  vector<int> special_chars_positions;
-  vector<char> unique_special_chars_decoded;
-
-  if (special_char_num == 0) {
-    return;
+  const vector<uint8_t>& flags = streams[STREAM_RECORD_FLAGS].symbols;
+  const vector<uint64_t>& deltas = streams[STREAM_REF_DELTAS].numbers;
+  const vector<uint64_t>& lengths = streams[STREAM_MATCH_LENGTHS].numbers;
+  const vector<uint64_t>& inserted = streams[STREAM_INSERTED_LENGTHS].numbers;
+  const vector<uint64_t>& runs = streams[STREAM_LITERAL_RUNS].numbers;
+  const vector<uint8_t>& bases = streams[STREAM_LITERAL_BASES].symbols;
+
+  size_t match_count = 0;
+  for (uint8_t flag : flags) {
+    match_count += flag & 1;
+  }
+  if (deltas.size() != match_count || lengths.size() != match_count ||
+      inserted.size() != match_count ||
+      runs.size() != flags.size() - match_count) {
+    throw runtime_error("Record streams do not match");
   }
 
-  // Store positions of special characters
-  int pos = 0;
-  for (int i = 1; i < special_char_num + 1; i++) {
-    pos += special_chars[i];
-    special_chars_positions.push_back(pos);
-    pos += 1;
+  // Every literal base is used once, matches add their lengths
+  uint64_t total_length = bases.size();
+  for (uint64_t length : lengths) {
+    total_length += length + kmer_length;
+    if (total_length < length) {
+      throw runtime_error("Corrupt match lengths");
+    }
   }
+  size_t start = target_seq.size();
+  target_seq.resize(start + total_length);
+  char* out = target_seq.data() + start;
+  char* out_end = target_seq.data() + target_seq.size();
+
+  size_t match_index = 0;
+  size_t run_index = 0;
+  size_t base_index = 0;
+  auto copy_bases = [&](uint64_t count) {
+    if (count > bases.size() - base_index) {
+      throw runtime_error("Literal stream too short");
+    }
+    const uint8_t* base = &bases[base_index];
+    uint64_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+    if (has_ssse3) {
+      i = expand_bases_ssse3(base, count, out);
+    }
+#endif
+    for (; i < count; ++i) {
+      out[i] = decode_into_base[base[i]];
+    }
+    out += count;
+    base_index += count;
+  };
 
-  // Decode special characters
-  for (int i = special_char_num + 2;
-       i < special_char_num + unique_special_chars_num + 2; i++) {
-    unique_special_chars_decoded.push_back(special_chars[i] + 'A');
+  for (uint8_t flag : flags) {
+    if (!(flag & 1)) {
+      copy_bases(runs[run_index++]);
+      continue;
+    }
+
+    // Bases inserted before a shifted match come first
+    copy_bases(inserted[match_index]);
+
+    int64_t length = lengths[match_index] + kmer_length;
+    ref_seq_position += (int64_t)deltas[match_index];
+    match_index++;
+
+    bool reverse = flag & 2;
+    int64_t last = reverse ? ref_seq_position - length + 1
+                           : ref_seq_position + length - 1;
+    if (min(ref_seq_position, last) < 0 ||
+        max(ref_seq_position, last) >= (int64_t)ref_seq.size()) {
+      throw runtime_error("Match outside of the reference");
+    }
+
+    const char* source = ref_seq.data() + ref_seq_position;
+    if (reverse) {
+      int64_t i = 0;
+#if defined(__x86_64__) || defined(__i386__)
+      if (has_ssse3) {
+        i = reverse_complement_ssse3(source, length, out);
+      }
+#endif
+      for (; i < length; i++) {
+        out[i] = complement_base[(unsigned char)source[-i]];
+      }
+      ref_seq_position -= length;
+    } else {
+      memcpy(out, source, length);
+      ref_seq_position += length;
+    }
+    out += length;
   }
 
-  // Insert special characters into the target sequence
-  for (int i = 0; i < special_chars_order.size(); i++) {
-    target_seq.insert(target_seq.begin() + special_chars_positions[i],
-                      unique_special_chars_decoded[special_chars_order[i]]);
+  if (out != out_end) {
+    throw runtime_error("Record streams do not match");
   }
 }
 
-void add_n_ranges(vector<char>& target_seq) {
+void add_masked_characters(vector<char>& target_seq) {
   /**
-   * Add N ranges to the target sequence
-   * based on the N ranges defined in the metadata
+   * Add N ranges and special characters back to the cleaned target sequence
+   * Both lists are sorted by position so the sequence is rebuilt in a single
+   * pass, N runs are appended as a whole
    * @author Polina Rykova
    */
-  int n_ranges_num = n_ranges[0];
-
-  if (n_ranges_num == 0) {
+  const vector<uint64_t>& n_ranges = streams[STREAM_N_RANGES].numbers;
+  const vector<uint64_t>& special_gaps = streams[STREAM_SPECIAL_GAPS].numbers;
+  const vector<uint8_t>& special_chars = streams[STREAM_SPECIAL_CHARS].symbols;
+  size_t n_ranges_num = n_ranges.size() / 2;
+  size_t special_char_num = special_chars.size();
+
+  if (special_gaps.size() != special_char_num) {
+    throw runtime_error("Special character streams do not match");
+  }
+  if (n_ranges_num == 0 && special_char_num == 0) {
     return;
   }
 
-  // For each position-length pair in n_ranges insert 'N's
-  int prev_pos = 0;
-  for (int i = 1; i < n_ranges_num * 2 + 1; i += 2) {
-    int start = n_ranges[i];
-    int length = n_ranges[i + 1];
+  vector<char> restored;
+  restored.reserve(target_seq.size() + special_char_num);
+
+  size_t seq_position = 0;
+  size_t n_index = 0;
+  size_t special_index = 0;
+  size_t next_n = 0;
+  size_t next_special = 0;
+  if (n_ranges_num > 0) {
+    next_n = n_ranges[0];
+  }
+  if (special_char_num > 0) {
+    next_special = special_gaps[0];
+  }
+
+  while (n_index < n_ranges_num || special_index < special_char_num) {
+    bool n_first = special_index == special_char_num ||
+                   (n_index < n_ranges_num && next_n < next_special);
+    size_t next = n_first ? next_n : next_special;
 
-    for (int j = 0; j < length; j++) {
-      target_seq.insert(target_seq.begin() + j + start + prev_pos, 'N');
+    // Copy the bases preceding the next masked position
+    size_t count = next - restored.size();
+    if (count > target_seq.size() - seq_position) {
+      throw runtime_error("Masked position outside of the sequence");
+    }
+    restored.insert(restored.end(), target_seq.begin() + seq_position,
+                    target_seq.begin() + seq_position + count);
+    seq_position += count;
+
+    if (n_first) {
+      size_t length = n_ranges[n_index * 2 + 1];
+      restored.insert(restored.end(), length, 'N');
+      n_index++;
+      if (n_index < n_ranges_num) {
+        next_n += length + n_ranges[n_index * 2];
+      }
+    } else {
+      restored.push_back(special_chars[special_index]);
+      special_index++;
+      if (special_index < special_char_num) {
+        next_special += 1 + special_gaps[special_index];
+      }
     }
-    prev_pos += start + length;
   }
+
+  restored.insert(restored.end(), target_seq.begin() + seq_position,
+                  target_seq.end());
+  target_seq.swap(restored);
 }
 
 void add_lowercase_ranges(vector<char>& target_seq) {
@@ -304,24 +694,23 @@ void add_lowercase_ranges(vector<char>& target_seq) {
    * based on the lowercase ranges defined in the metadata
    * @author Polina Rykova
    */
-  int lower_case_ranges_num = lower_case_ranges[0];
-
-  if (lower_case_ranges_num == 0) {
-    return;
-  }
-
-  // For each position-length pair change letters to lowercase
-  int prev_pos = 0;
-  for (int i = 1; i < lower_case_ranges_num * 2 + 1; i += 2) {
-    int start = lower_case_ranges[i];
-    int length = lower_case_ranges[i + 1];
+  const vector<uint64_t>& lower_case_ranges =
+      streams[STREAM_LOWERCASE_RANGES].numbers;
+
+  // For each gap-length pair change letters to lowercase
+  uint64_t prev_pos = 0;
+  for (size_t i = 0; i + 1 < lower_case_ranges.size(); i += 2) {
+    uint64_t start = prev_pos + lower_case_ranges[i];
+    uint64_t length = lower_case_ranges[i + 1];
+    if (start + length > target_seq.size()) {
+      throw runtime_error("Lowercase range outside of the sequence");
+    }
 
-    for (int j = 0; j < length; j++) {
-      target_seq[j + start + prev_pos] =
-          tolower(target_seq[j + start + prev_pos]);
+    for (uint64_t j = start; j < start + length; j++) {
+      target_seq[j] = tolower(target_seq[j]);
     }
 
-    prev_pos += start + length;
+    prev_pos = start + length;
   }
 }
 
@@ -338,17 +727,19 @@ void write_reconstructed_sequence_to_file() {
 
   out << header << endl;  // Write the header
 
-  out << endl;  // Write an empty line after the header
-
-  // Write out the reconstructed sequence with line breaks
-  int line_length_values_num = line_lenghts[0];
-  int curr_seq_position = 0;
+  // Write out the reconstructed sequence with line breaks, empty lines are
+  // lines of length 0
+  const vector<uint64_t>& line_lenghts = streams[STREAM_LINE_LENGTHS].numbers;
+  uint64_t curr_seq_position = 0;
 
-  for (int i = 1; i < line_length_values_num; i += 2) {
-    int lenght = line_lenghts[i];
-    int repeat_cnt = line_lenghts[i + 1];
+  for (size_t i = 0; i + 1 < line_lenghts.size(); i += 2) {
+    uint64_t lenght = line_lenghts[i];
+    uint64_t repeat_cnt = line_lenghts[i + 1];
+    if (lenght * repeat_cnt > target_seq.size() - curr_seq_position) {
+      throw runtime_error("Line lengths exceed the sequence");
+    }
 
-    for (int j = 0; j < repeat_cnt; j++) {
+    for (uint64_t j = 0; j < repeat_cnt; j++) {
       out.write(&target_seq[curr_seq_position], lenght);
       out.put('\n');
       curr_seq_position += lenght;
@@ -357,18 +748,6 @@ void write_reconstructed_sequence_to_file() {
   out.close();
 }
 
-void decompress_7z(const string& archive_name) {
-  /**
-   * Decompress 7z archive to get data
-   * @author Polina Rykova
-   */
-  string command = "7z x " + archive_name + " -y";
-  int result = system(command.c_str());
-  if (result != 0) {
-    throw runtime_error("7z decompression failed");
-  }
-}
-
 void cleanup() {
   /**
    * Clean up and release all allocated memory
@@ -379,15 +758,16 @@ void cleanup() {
 
 void print_memory_usage() {
   /**
-   * Show memory used for the program
+   * Show memory used for the program, current and peak
    * @author Lorena Švenjak
    */
   ifstream status_file("/proc/self/status");
   string line;
   while (getline(status_file, line)) {
-    if (line.substr(0, 6) == "VmRSS:") {
+    if (line.substr(0, 6) == "VmHWM:") {
+      cout << "Peak memory usage: " << line.substr(6) << endl;
+    } else if (line.substr(0, 6) == "VmRSS:") {
       cout << "Memory usage (Resident Set Size): " << line.substr(6) << endl;
-      break;
     }
   }
 }
@@ -398,15 +778,23 @@ int main(int argc, char* argv[]) {
    */
 
   // Check if passed arguments are valid
-  if (argc != 5) {
+  if (argc != 5 && argc != 7) {
     show_help_message("Invalid number of arguments.");
     return 1;
   }
 
-  if (strcmp(argv[1], "-r") != 0 || strcmp(argv[3], "-t") != 0) {
+  if (strcmp(argv[1], "-r") != 0 || strcmp(argv[3], "-t") != 0 ||
+      (argc == 7 && strcmp(argv[5], "--threads") != 0)) {
     show_help_message("Invalid arguments.");
     return 1;
   }
+  if (argc == 7) {
+    decoder_threads = atoi(argv[6]);
+    if (decoder_threads < 1) {
+      show_help_message("Thread count must be positive.");
+      return 1;
+    }
+  }
 
   // Start tracking time taken for decompression
   gettimeofday(&timer_start, nullptr);
@@ -418,21 +806,25 @@ int main(int argc, char* argv[]) {
 
   initialize_structures();
 
-  load_and_clean_reference(input_file_names.reference_file, ref_seq);
+  try {
+    // The container is decoded while the reference is read
+    future<void> container_ready =
+        async(launch::async, load_container,
+              input_file_names.compressed_target_file);
+    load_and_clean_reference(input_file_names.reference_file, ref_seq);
+    container_ready.get();
 
-  decompress_7z("compressed.7z");
+    decompress_target_sequence(target_seq);
 
-  load_metadata(input_file_names.compressed_target_file);
+    add_masked_characters(target_seq);
+    add_lowercase_ranges(target_seq);
 
-  decompress_target_sequence(input_file_names.compressed_target_file,
-                             target_seq);
-
-  add_n_ranges(target_seq);
-  add_special_characters(target_seq);
-  add_lowercase_ranges(target_seq);
-
-  write_reconstructed_sequence_to_file();
-  remove("output.txt");
+    write_reconstructed_sequence_to_file();
+  } catch (const exception& e) {
+    cerr << "Error: " << e.what() << endl;
+    cleanup();
+    return 1;
+  }
 
   cout << "Decompression completed successfully." << endl;
   cout << "Reconstructed sequence written to reconstructed_sequence.fna"
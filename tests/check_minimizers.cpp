@@ -0,0 +1,116 @@
+// Check of compute_minimizers() against a brute force rightmost minimum
+//
+// The compressor is compiled into this binary in its own namespace, every
+// system header it uses is included first so the include guards keep the
+// standard library out of the namespace
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+namespace compressor {
+#include "../compress_hirgc.cpp"
+}
+
+using namespace std;
+
+const int CHECK_K = 12;
+const int64_t CHECK_BASES = 200000;
+const int CHECK_WINDOWS[] = {2, 3, 4, 5, 8, 10, 16, 32};
+
+vector<int64_t> brute_force_minimizers(const compressor::HugeVector<int>& bases,
+                                       int window) {
+  /**
+   * Rightmost canonical k-mer of smallest hash in every window of window
+   * consecutive k-mers, a shorter sequence is one window
+   */
+  const uint64_t mask = compressor::kmer_mask<CHECK_K>();
+  int64_t kmer_count = (int64_t)bases.size() - CHECK_K + 1;
+  vector<uint64_t> order(kmer_count);
+  for (int64_t start = 0; start < kmer_count; ++start) {
+    uint64_t value = 0;
+    uint64_t rc_value = 0;
+    for (int i = 0; i < CHECK_K; ++i) {
+      value = ((value << 2) + bases[start + i]) & mask;
+      rc_value = (rc_value >> 2) +
+                 ((uint64_t)(3 - bases[start + i]) << (2 * (CHECK_K - 1)));
+    }
+    order[start] = min(value, rc_value) * compressor::KMER_HASH_MULTIPLIER;
+  }
+
+  vector<int64_t> selected;
+  int64_t window_count = max<int64_t>(1, kmer_count - window + 1);
+  for (int64_t first = 0; first < window_count; ++first) {
+    int64_t last = min(first + window, kmer_count) - 1;
+    int64_t best = first;
+    for (int64_t k = first + 1; k <= last; ++k) {
+      if (order[k] <= order[best]) {
+        best = k;
+      }
+    }
+    if (selected.empty() || selected.back() != best) {
+      selected.push_back(best);
+    }
+  }
+  return selected;
+}
+
+int main() {
+  /**
+   * Compare the minimizers of a fixed random sequence for several window
+   * sizes, powers of two included, and fail on any difference
+   */
+  compressor::HugeVector<int> bases(CHECK_BASES);
+  uint64_t state = 32;
+  for (int& base : bases) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    base = state >> 62;
+  }
+
+  int failures = 0;
+  for (int window : CHECK_WINDOWS) {
+    vector<compressor::Minimizer> minimizers;
+    compressor::compute_minimizers<CHECK_K>(bases, window, minimizers);
+    vector<int64_t> expected = brute_force_minimizers(bases, window);
+
+    size_t differences = max(minimizers.size(), expected.size());
+    for (size_t i = 0; i < min(minimizers.size(), expected.size()); ++i) {
+      differences -= minimizers[i].pos == expected[i];
+    }
+    cout << "w=" << window << ": " << minimizers.size() << " minimizers, "
+         << differences << " differences" << endl;
+    failures += differences != 0;
+  }
+
+  return failures ? 1 : 0;
+}